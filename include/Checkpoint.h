@@ -0,0 +1,141 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "MappedFile.h"
+
+class Simulation;
+class PhysicsEngine;
+
+// Binary snapshot of a running simulation that a later run resumes from
+//
+// File layout (little endian):
+//   char     magic[4]     "EMCK"
+//   uint32   version      1, any other version is rejected
+//   float64  time         sim time the snapshot was taken at
+//   int64    step         steps taken to get there
+//   scene                 name, window, camera, lighting, physics and run settings, objects, fields
+//   state                 uint32 scalar size (4 or 8) of the engine, then every particle array
+//                         and the integrator history, see PhysicsEngineT::saveState
+// Strings and arrays are a uint64 element count followed by the elements.
+class Checkpoint {
+    public:
+        static constexpr std::uint32_t Version = 1;
+
+        // Sequential output, arrays are written straight from memory
+        class Writer {
+            public:
+                Writer(std::ostream& out) : out(out) {}
+
+                template <typename T> void put(const T& value) {
+                    static_assert(std::is_trivially_copyable<T>::value, "put needs a plain value");
+                    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+                }
+                void putString(const std::string& s) {
+                    put<std::uint64_t>(s.size());
+                    out.write(s.data(), s.size());
+                }
+                template <typename T, typename A> void putArray(const std::vector<T, A>& v) {
+                    static_assert(std::is_trivially_copyable<T>::value, "putArray needs plain values");
+                    put<std::uint64_t>(v.size());
+                    out.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+                }
+
+            private:
+                std::ostream& out;
+        };
+
+        // Bounds checked input over the mapped file, anything running past the end throws
+        class Reader {
+            public:
+                Reader(const unsigned char* data, std::size_t size, std::size_t offset, const std::string& path)
+                    : data(data), size(size), at(offset), path(path) {}
+
+                template <typename T> T get() {
+                    static_assert(std::is_trivially_copyable<T>::value, "get needs a plain value");
+                    T value;
+                    take(&value, sizeof(T));
+                    return value;
+                }
+                std::string getString() {
+                    std::uint64_t n = get<std::uint64_t>();
+                    if (n > size - at) fail("truncated string");
+                    std::string s(reinterpret_cast<const char*>(data + at), n);
+                    at += n;
+                    return s;
+                }
+                template <typename T, typename A> void getArray(std::vector<T, A>& v) {
+                    getArrayAs<T>(v);
+                }
+                // Array stored as Stored, converted element by element when T differs
+                template <typename Stored, typename T, typename A> void getArrayAs(std::vector<T, A>& v) {
+                    std::uint64_t n = get<std::uint64_t>();
+                    if (n > (size - at) / sizeof(Stored)) fail("truncated array");
+                    v.resize(n);
+                    if (n == 0) {
+                    } else if (std::is_same<Stored, T>::value) {
+                        std::memcpy(v.data(), data + at, n * sizeof(T));
+                    } else {
+                        for (std::uint64_t i = 0; i < n; i++) {
+                            Stored s;
+                            std::memcpy(&s, data + at + i * sizeof(Stored), sizeof(Stored));
+                            v[i] = static_cast<T>(s);
+                        }
+                    }
+                    at += n * sizeof(Stored);
+                }
+
+                std::size_t offset() const { return at; }
+                [[noreturn]] void fail(const std::string& message) const {
+                    throw std::runtime_error("Bad checkpoint " + path + ": " + message);
+                }
+
+            private:
+                const unsigned char* data;
+                std::size_t size;
+                std::size_t at;
+                std::string path;
+
+                void take(void* out, std::size_t n) {
+                    if (n > size - at) fail("truncated");
+                    std::memcpy(out, data + at, n);
+                    at += n;
+                }
+        };
+
+        // Write the scene, the engine state and the clock to path
+        // The file is written next to path and renamed over it, so an interrupted write leaves the last checkpoint intact
+        // Throws std::runtime_error if the file cannot be written
+        static void write(const std::string& path, const Simulation& sim, const PhysicsEngine& engine, double time, long step);
+
+        // Map a checkpoint and fill sim with the scene it was taken from
+        // Throws std::runtime_error if the file is missing or malformed
+        static std::shared_ptr<const Checkpoint> open(const std::string& path, Simulation& sim);
+
+        // Replace the particles of an engine loaded from that scene with the saved state
+        void restore(PhysicsEngine& engine) const;
+
+        double time = 0;
+        long step = 0;
+
+    private:
+        Checkpoint() = default;
+
+        MappedFile file;
+        std::string path;
+        std::size_t stateOffset = 0;
+        std::size_t objectCount = 0;
+
+        static void writeScene(Writer& out, const Simulation& sim);
+        static void readScene(Reader& in, Simulation& sim);
+};
+
+#endif // __CHECKPOINT_H__
@@ -0,0 +1,75 @@
+#ifndef __EXPRESSION_H__
+#define __EXPRESSION_H__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Scalar expression of t, x, y, z compiled once into stack bytecode
+// Grammar: + - * / ^, unary -, parentheses, the constants pi and e and the functions
+// sin cos tan exp log sqrt abs tanh floor min max pow atan2
+// Constant subtrees are folded while parsing, so "2*pi*50" costs a single load
+class Expression {
+    public:
+        // Throws std::runtime_error describing the first syntax error
+        Expression(const std::string& text = "0");
+
+        float evaluate(float t, float x, float y, float z) const;
+
+        bool isConstant() const { return !usesTime && !usesPosition; }
+        bool dependsOnTime() const { return usesTime; }
+        bool dependsOnPosition() const { return usesPosition; }
+
+        const std::string& source() const { return text; }
+        std::size_t size() const { return code.size(); }
+
+    private:
+        enum class Op : std::uint8_t {
+            Const, T, X, Y, Z,
+            Add, Sub, Mul, Div, Pow, Min, Max, Atan2,
+            Neg, Square, Sin, Cos, Tan, Exp, Log, Sqrt, Abs, Tanh, Floor
+        };
+
+        struct Instr {
+            Op op;
+            float value;
+        };
+
+        // Parse tree, only alive while compiling
+        struct Node {
+            Op op;
+            float value;
+            int a, b;
+        };
+
+        // Evaluation stack size; deeper expressions are rejected at compile time
+        static const int MaxStack = 32;
+
+        std::string text;
+        std::vector<Instr> code;
+        bool usesTime = false;
+        bool usesPosition = false;
+
+        // Parser state
+        std::vector<Node> nodes;
+        std::size_t pos = 0;
+
+        int parseSum();
+        int parseProduct();
+        int parseUnary();
+        int parsePower();
+        int parsePrimary();
+        void skipSpaces();
+        bool accept(char c);
+        void expect(char c);
+        [[noreturn]] void fail(const std::string& message) const;
+
+        // Build a node, folding it into a constant when every operand is one
+        int make(Op op, int a = -1, int b = -1, float value = 0);
+        void emit(int node, int depth, int& maxDepth);
+
+        static float apply(Op op, float a, float b);
+        static int arity(Op op);
+};
+
+#endif // __EXPRESSION_H__
@@ -0,0 +1,66 @@
+#ifndef __FIELDGRID_H__
+#define __FIELDGRID_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "Vec3.h"
+#include "MappedFile.h"
+#include "PairKernel.h"
+
+// Regular 3D grid of field vectors read straight out of a memory-mapped file
+//
+// File layout (little endian):
+//   char     magic[4]     "EMFG"
+//   uint32   version      1
+//   uint32   nx, ny, nz   nodes per axis, at least 2 each
+//   float    origin[3]    position of node (0, 0, 0)
+//   float    spacing[3]   node distance per axis
+//   uint32   blocks       number of vector fields stored back to back
+//   float    data[blocks][nz][ny][nx][3]
+class FieldGrid {
+    public:
+        struct Header {
+            char magic[4];
+            std::uint32_t version;
+            std::uint32_t nx, ny, nz;
+            float origin[3];
+            float spacing[3];
+            std::uint32_t blocks;
+        };
+
+        static const std::uint32_t Version = 1;
+
+        // Map a grid file, or share the mapping another field already opened
+        // Throws std::runtime_error if the file is missing or malformed
+        static std::shared_ptr<const FieldGrid> open(const std::string& path);
+
+        int blockCount() const { return static_cast<int>(header.blocks); }
+
+        // Trilinear sample of one block, zero outside the grid
+        Vec3f sample(int block, const Vec3f& pos) const;
+
+        // scale * sample at every position in [begin, end), written to out
+        void sampleMany(PairKernel::Path path, int block, const float* x, const float* y, const float* z,
+                        std::size_t begin, std::size_t end, float scale,
+                        float* outX, float* outY, float* outZ) const;
+
+    private:
+        FieldGrid() = default;
+
+        MappedFile file;
+        Header header;
+        const float* data = nullptr;
+
+        const float* blockData(int block) const;
+
+        void sampleScalar(int block, const float* x, const float* y, const float* z,
+                          std::size_t begin, std::size_t end, float scale,
+                          float* outX, float* outY, float* outZ) const;
+        void sampleAVX2(int block, const float* x, const float* y, const float* z,
+                        std::size_t begin, std::size_t end, float scale,
+                        float* outX, float* outY, float* outZ) const;
+};
+
+#endif // __FIELDGRID_H__
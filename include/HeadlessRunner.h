@@ -0,0 +1,28 @@
+#ifndef __HEADLESSRUNNER_H__
+#define __HEADLESSRUNNER_H__
+
+#include <string>
+#include <memory>
+
+#include "JSONReader.h"
+#include "PhysicsEngine.h"
+
+// Batch mode: steps the physics engine as fast as possible without SDL and writes the final state
+class HeadlessRunner {
+    public:
+        HeadlessRunner(Simulation* sim);
+
+        // Step until runModel.steps or runModel.endTime is reached, returns a process exit code
+        int run();
+
+    private:
+        Simulation* sim;
+        std::unique_ptr<PhysicsEngine> phyeng;
+
+        // One CSV row per particle in scene order
+        bool writeState(const std::string& path, double simTime);
+        // Checkpoint of the whole run at runModel.checkpoint
+        bool saveCheckpoint(double simTime, long step);
+};
+
+#endif // __HEADLESSRUNNER_H__
@@ -3,8 +3,11 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 #include "Vec3.h"
 
+class Checkpoint;
+
 class ObjectModel {
 
     public:
@@ -28,14 +31,15 @@ class ObjectModel {
         std::string name;
         Shape shape;
 
-        Vec3f center;
+        // Parsed in double so double engines start from the values as written
+        Vec3d center;
         float radius;
         Color color;
         bool wireframe;
-        float mass;
-        float charge;
+        double mass;
+        double charge;
 
-        Vec3f initVelocity;
+        Vec3d initVelocity;
         Vec3f initAccel;
         Vec3f initAngVelocity;
         Vec3f initAngAccel;
@@ -50,7 +54,89 @@ struct FieldModel {
     std::string name;
     Type type;
     Vec3f direction;
-    float strength;
+    float strength = 1.0f;
+    // Quoted strength or direction entries are expressions of t, x, y, z, e.g. "5e3 * sin(2*pi*t)"
+    std::string strengthExpr;
+    std::string directionExpr[3];
+    // Optional vector grid file (resolved against the scene's folder) and the block to use,
+    // the grid replaces direction and strength scales it
+    std::string grid;
+    int gridBlock = 0;
+};
+
+struct PhysicsModel {
+    enum ForceMethod {
+        AllPairs,
+        BarnesHut,
+        Tiled,
+        ParticleMesh
+    };
+
+    enum Integrator {
+        RK4,
+        DormandPrince,
+        Boris,
+        BlockStep
+    };
+
+    enum PmBoundary {
+        Isolated,
+        Periodic
+    };
+
+    enum SimdPath {
+        Auto,
+        Scalar,
+        AVX2,
+        AVX512
+    };
+
+    enum Precision {
+        Float,
+        Double,
+        Mixed
+    };
+
+    ForceMethod forceMethod = AllPairs;
+    SimdPath simd = Auto;
+    // Scalar type of the physics core, mixed keeps double state with float pair kernels
+    Precision precision = Float;
+    Integrator integrator = RK4;
+    // Error tolerances of the adaptive integrator
+    float absTol = 1e-6f;
+    float relTol = 1e-5f;
+    // Block time-stepping levels and timestep accuracy
+    int maxLevel = 8;
+    float eta = 0.05f;
+    float theta = 0.5f;
+    // Particle-mesh grid nodes per axis, boundary and periodic box side (0 fits the particles)
+    int pmGrid = 64;
+    PmBoundary pmBoundary = Isolated;
+    float pmBox = 0;
+    // P3M short range correction and its split radius in grid cells
+    bool p3m = false;
+    float p3mSplit = 1.25f;
+    // Sphere collisions using each object's radius, and the restitution of every contact
+    bool collisions = false;
+    float restitution = 1.0f;
+    // Worker threads for the force loops, 0 uses every core
+    int threads = 0;
+};
+
+struct RunModel {
+    // Headless runs step the engine as fast as possible without opening a window
+    bool headless = false;
+    // Stop after this many steps or at this sim time, whichever is given (0 = unused)
+    int steps = 0;
+    float endTime = 0;
+    float dt = 1 / 60.0f;
+    // Window runs blend the last two physics snapshots for smooth motion between steps
+    bool interpolate = true;
+    // Final particle state is written here as CSV
+    std::string output = "final_state.csv";
+    // Binary checkpoint of the whole run, rewritten every checkpointEvery steps (0 = only when the run ends)
+    std::string checkpoint;
+    int checkpointEvery = 0;
 };
 
 class Simulation {
@@ -58,7 +144,15 @@ class Simulation {
     
     std::string retrieveString(std::string line, int pos);
     float retrieveFloat(std::string line, int pos);
+    double retrieveDouble(std::string line, int pos);
+    // Text of the number starting at or after pos
+    std::string retrieveNumber(std::string line, int pos);
     Vec3f retrieveVector(std::string line);
+    Vec3d retrieveVector3d(std::string line);
+    // Items of a [a, "b", c] array split on top level commas, quotes removed
+    std::vector<std::string> retrieveList(std::string line);
+    // Throws if text is not a valid field expression
+    void checkExpression(const std::string& text);
     ObjectModel::Color retrieveColor(std::string line);
     bool retrieveBool(std::string line);
     
@@ -67,9 +161,16 @@ class Simulation {
     void setObjectParam(ObjectModel& objM, std::string line, std::string memberName, int pos);
     void setLightingParam(std::string line, std::string memberName, int pos);
     void setFieldParam(FieldModel& fieldM, std::string line, std::string memberName, int pos);
+    void setPhysicsParam(std::string line, std::string memberName, int pos);
+    void setRunParam(std::string line, std::string memberName, int pos);
+
+    // Folder of the scene file, relative paths inside it start here
+    std::string sceneDir;
 
     public:
         Simulation(char* filename);
+        // Empty scene for a checkpoint to fill
+        Simulation() : loadedSuccess(false) {}
         void displaySim();
         bool loadedSuccess;
         
@@ -80,6 +181,14 @@ class Simulation {
         int width;
         int height;
         float scale;
+        // Geometry hands every triangle to SDL, Software rasterizes them with a depth buffer into one texture
+        enum RenderMode {
+            Geometry,
+            Software
+        };
+        RenderMode renderMode = Geometry;
+        // Threads the software renderer fills tiles with, 0 uses every hardware thread
+        int renderThreads = 0;
         
         // Camera Members
         float distance;
@@ -97,9 +206,18 @@ class Simulation {
         float shininess;
         float gamma;
         
+        // Physics Members
+        PhysicsModel physicsModel;
+
+        // Run Members
+        RunModel runModel;
+
         // Objects
         std::vector<ObjectModel> objModels;
         std::vector<FieldModel> fieldModels;
+
+        // Checkpoint the run resumes from, null for a fresh start
+        std::shared_ptr<const Checkpoint> restart;
 };
 
 #endif // __JSONREADER_H__
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+#include <string>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file (mmap, or CreateFileMapping on Windows)
+class MappedFile {
+    public:
+        MappedFile() = default;
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator = (const MappedFile&) = delete;
+
+        // Map path, returns false (and stays unmapped) if it cannot be opened
+        bool open(const std::string& path);
+        void close();
+
+        const unsigned char* data() const { return bytes; }
+        std::size_t size() const { return length; }
+
+    private:
+        const unsigned char* bytes = nullptr;
+        std::size_t length = 0;
+
+#ifdef _WIN32
+        void* file = nullptr;
+        void* mapping = nullptr;
+#endif
+};
+
+#endif // __MAPPEDFILE_H__
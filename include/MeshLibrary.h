@@ -0,0 +1,54 @@
+#ifndef __MESHLIBRARY_H__
+#define __MESHLIBRARY_H__
+
+#include <vector>
+#include <memory>
+
+#include "Vec3.h"
+
+struct Triangle {
+    int a, b, c;
+
+    Triangle(int a, int b, int c) : a(a), b(b), c(c) {}
+};
+
+// Mesh of unit size centered on the origin
+struct Mesh {
+    std::vector<Vec3f> vertices;
+    std::vector<Triangle> tris;
+    // Unit normal of each vertex, the average of the faces around it
+    std::vector<Vec3f> normals;
+    // Distance of the farthest vertex from the origin
+    float radius = 0;
+};
+
+// Builds each shape once and hands the same mesh to every object using it
+class MeshLibrary {
+    public:
+        enum class Shape {
+            Tetrahedron,
+            Icosahedron,
+            Sphere,
+            Cube
+        };
+
+        // Subdivisions of the icosahedron a sphere gets by default, and the most it can get
+        static const int SphereLevel = 3;
+        static const int MaxLevel = 5;
+
+        // Shared unit mesh, level is the sphere's subdivision count (clamped to MaxLevel) and ignored for the other shapes
+        // Only the render thread builds meshes, so the library is not locked
+        static std::shared_ptr<const Mesh> get(Shape shape, int level = SphereLevel);
+
+    private:
+        static Mesh tetrahedron();
+        static Mesh icosahedron();
+        static Mesh cube();
+        // Split every triangle in four and push the new vertices out to the unit sphere
+        static Mesh subdivide(const Mesh& mesh);
+        // Wind every triangle counterclockwise seen from outside, then fill normals and radius once so drawing only rotates them
+        // Every shape is convex around the origin, so outside is away from it
+        static void finish(Mesh& mesh);
+};
+
+#endif // __MESHLIBRARY_H__
@@ -2,63 +2,47 @@
 #define __OBJECTS_H__
 
 #include <vector>
-#include <unordered_map>
-#include <utility>
+#include <memory>
 #include <cmath>
 
 #include "Vec3.h"
+#include "Quaternion.h"
+#include "MeshLibrary.h"
 #include <SDL.h>
 
-const float PI = static_cast<float>( 4 * std::atan(1.0));
-
-struct Triangle {
-    int a, b, c;
-
-    Triangle(int a, int b, int c) : a(a), b(b), c(c) {}
-};
-
+// One drawn instance of a shared unit mesh
 class Object {
     public:
+        Object(MeshLibrary::Shape shape, Vec3f center, float scale, SDL_Color color, bool wireframe);
+
+        MeshLibrary::Shape shape;
+        // Shared with every other object of the same shape, spheres swap levels as their screen size changes
+        std::shared_ptr<const Mesh> mesh;
+        float scale;
+
         Vec3f center;
+        Quaternion orientation;
         bool wireframe;
         SDL_Color color;
 
-        std::vector<Vec3f> vertices;
-        std::vector<Triangle> tris;
-
-        // Mechanics
-
-};
-
-class Tetrahedron : public Object {
-    public:
-        Tetrahedron(Vec3f center, float radius, SDL_Color color, bool wireframe);
-};
-
-class Icosahedron : public Object {
-    public:
-        Icosahedron(Vec3f center, float radius, SDL_Color color, bool wireframe);
-};
-
-struct PairHash {
-    std::size_t operator()(const std::pair<int, int>& p) const {
-        return std::hash<int>()(p.first) ^ (std::hash<int>()(p.second) << 1);
-    }
-};
-
-class Sphere : public Object {
-    public:
-        Sphere(Vec3f center, float radius, SDL_Color color, bool wireframe);
-    private:
-        std::unordered_map<std::pair<int, int>, int, PairHash> midPointIndex;
-        float radius;
+        void place(const Vec3f& center, const Quaternion& orientation);
 
-        int getMidpoint(int i1, int i2);
+        // Mesh vertices scaled, rotated and moved to the current pose, the only per-frame pass over them
+        void toWorld(std::vector<Vec3f>& out) const;
 };
 
-class Cube : public Object {
+// Binds a renderable mesh to its particle in the engine's ParticleStore
+// Position, orientation and spin all live in the store, the mesh only follows them
+class PhysicsObject {
     public:
-        Cube(Vec3f, float radius, SDL_Color color, bool wireframe);
+    Object* obj;
+    
+    // Index of this object in PhysicsEngine::particles
+    std::size_t index;
+    
+    Vec3f acceleration;
+    
+    PhysicsObject(Object* o, std::size_t index);
 };
 
-#endif // __OBJECTS_H__
\ No newline at end of file
+#endif // __OBJECTS_H__
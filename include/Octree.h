@@ -0,0 +1,49 @@
+#ifndef __OCTREE_H__
+#define __OCTREE_H__
+
+#include <vector>
+#include "Vec3.h"
+
+// Barnes-Hut octree storing the charge and mass monopoles of every cell
+class Octree {
+    public:
+        struct Node {
+            // Geometric cell
+            Vec3f center;
+            float halfSize;
+
+            // Monopole moments
+            float totalCharge;
+            float totalMass;
+            Vec3f chargeCenter;   // Weighted by |q| so mixed signs still give a point inside the cell
+            Vec3f massCenter;
+
+            // Index of the first of 8 consecutive children, -1 for leaves
+            int firstChild;
+            // Range of bodies (into order) held by this node
+            int begin, end;
+        };
+
+        // Rebuild the tree around n bodies given as separate coordinate arrays
+        void build(const float* x, const float* y, const float* z, const float* charges, const float* masses, int n);
+
+        // Force on body i at pos where kq = k * q_i and gm = G * m_i
+        // Cells with size / distance < theta are replaced by their monopoles
+        Vec3f computeForce(int i, const Vec3f& pos, float kq, float gm, float theta) const;
+
+    private:
+        std::vector<Node> nodes;
+        std::vector<int> order;
+        std::vector<int> scratch;
+
+        const float* x = nullptr;
+        const float* y = nullptr;
+        const float* z = nullptr;
+        const float* charges = nullptr;
+        const float* masses = nullptr;
+
+        void buildNode(int nodeIdx, int depth);
+        void computeMoments(Node& node);
+};
+
+#endif // __OCTREE_H__
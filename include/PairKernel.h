@@ -0,0 +1,34 @@
+#ifndef __PAIRKERNEL_H__
+#define __PAIRKERNEL_H__
+
+#include <cstddef>
+#include "Vec3.h"
+
+// Fused Coulomb + gravity sum over a run of emitters, vectorized with AVX2 or AVX-512
+class PairKernel {
+    public:
+        enum class Path {
+            Scalar,
+            AVX2,
+            AVX512
+        };
+
+        // Widest path the running CPU (and OS) supports, checked through CPUID
+        static Path detect();
+        static const char* name(Path path);
+
+        // Sum of r * (kq * q_j - gm * m_j) / |r|^3 over emitters [begin, end) where r = pos - p_j
+        // A single 1/r^3 is shared by both forces; emitters exactly at pos (the target itself) add nothing
+        static Vec3f sum(Path path, const float* x, const float* y, const float* z, const float* q, const float* m,
+                         std::size_t begin, std::size_t end, const Vec3f& pos, float kq, float gm);
+
+    private:
+        static Vec3f sumScalar(const float* x, const float* y, const float* z, const float* q, const float* m,
+                               std::size_t begin, std::size_t end, const Vec3f& pos, float kq, float gm);
+        static Vec3f sumAVX2(const float* x, const float* y, const float* z, const float* q, const float* m,
+                             std::size_t begin, std::size_t end, const Vec3f& pos, float kq, float gm);
+        static Vec3f sumAVX512(const float* x, const float* y, const float* z, const float* q, const float* m,
+                               std::size_t begin, std::size_t end, const Vec3f& pos, float kq, float gm);
+};
+
+#endif // __PAIRKERNEL_H__
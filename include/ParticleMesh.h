@@ -0,0 +1,90 @@
+#ifndef __PARTICLEMESH_H__
+#define __PARTICLEMESH_H__
+
+#include <vector>
+#include <complex>
+
+#include "Vec3.h"
+#include "ThreadPool.h"
+
+// Particle-mesh Poisson solver for charge and mass at once
+// Charges are deposited into the real part and masses into the imaginary part of one complex grid,
+// so a single FFT round trip gives both potentials (the Green's function is real and even)
+class ParticleMesh {
+    public:
+        enum class Boundary {
+            // Zero padded to twice the grid so images never interact (Hockney-Eastwood)
+            Isolated,
+            // Field of a periodic lattice of the box, positions are wrapped into it
+            Periodic
+        };
+
+        typedef std::complex<float> Cell;
+
+        // gridSize is rounded up to a power of two, box <= 0 fits the box to the particles
+        // splitCells > 0 enables P3M: the mesh keeps the erf part of 1/r and a cell list adds the erfc part
+        void configure(int gridSize, Boundary boundary, float box, float splitCells);
+
+        // Deposit, solve and differentiate for the current positions
+        void solve(const float* x, const float* y, const float* z, const float* charges, const float* masses,
+                   int n, ThreadPool& pool);
+
+        // Force on a body at pos where kq = k * q_i and gm = G * m_i, skipping body i in the short range sum
+        Vec3f computeForce(int i, const Vec3f& pos, float kq, float gm) const;
+
+    private:
+        int gridSize = 64;
+        Boundary boundary = Boundary::Isolated;
+        float box = 0;
+        float splitCells = 0;
+
+        // Transform length per axis: 2 * gridSize when isolated
+        int M = 0;
+        Vec3f origin;
+        float h = 0;
+
+        std::vector<Cell> grid;
+        // Charges and masses are deposited relative to their largest magnitudes, otherwise
+        // the float rounding of one part (e.g. kg masses) would drown the other (uC charges)
+        float chargeScale = 1;
+        float massScale = 1;
+        // Real Fourier transform of the Green's function, scaled by greenScale at solve time
+        std::vector<float> green;
+        float greenH = 0;
+        // -grad phi on the gridSize^3 physical nodes, q part real and m part imaginary
+        std::vector<Cell> ex, ey, ez;
+
+        // FFT tables for length M
+        std::vector<Cell> twiddles;
+        std::vector<int> bitReverse;
+        std::vector<Cell> lineScratch;
+
+        void prepareTables();
+        void prepareGreen(ThreadPool& pool);
+        void fitBox(const float* x, const float* y, const float* z, int n);
+        void fftLine(Cell* a, bool inverse) const;
+        // 3D transform of g, pruned skips the lines that only cross the isolated zero padding
+        void fft3(std::vector<Cell>& g, bool inverse, bool pruned, ThreadPool& pool);
+
+        // CIC weights of a position: base node per axis and the fraction towards the next one
+        void cicWeights(const Vec3f& pos, int* base, float* frac) const;
+        int wrap(int n, int size) const { return ((n % size) + size) % size; }
+
+        // P3M short range: bodies bucketed into cells at least cutoff wide
+        float cutoff = 0;
+        int cells = 0;
+        Vec3f cellOrigin;
+        float cellSize = 0;
+        std::vector<int> cellStart;
+        std::vector<int> cellOrder;
+        void buildCells(int n);
+        Vec3f shortRange(int i, const Vec3f& pos, float kq, float gm) const;
+
+        const float* x = nullptr;
+        const float* y = nullptr;
+        const float* z = nullptr;
+        const float* charges = nullptr;
+        const float* masses = nullptr;
+};
+
+#endif // __PARTICLEMESH_H__
@@ -0,0 +1,89 @@
+#ifndef __PARTICLESTORE_H__
+#define __PARTICLESTORE_H__
+
+#include <vector>
+#include <cstddef>
+#include <new>
+
+#include "Vec3.h"
+#include "Quaternion.h"
+
+// Allocator handing out cache-line aligned blocks so every array starts on a 64 byte boundary
+template <typename T, std::size_t Align = 64> struct AlignedAllocator {
+    typedef T value_type;
+
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+    template <typename U> struct rebind { typedef AlignedAllocator<U, Align> other; };
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+    void deallocate(T* p, std::size_t) {
+        ::operator delete(p, std::align_val_t(Align));
+    }
+
+    template <typename U> bool operator == (const AlignedAllocator<U, Align>&) const { return true; }
+    template <typename U> bool operator != (const AlignedAllocator<U, Align>&) const { return false; }
+};
+
+template <typename Real> using AlignedArray = std::vector<Real, AlignedAllocator<Real>>;
+typedef AlignedArray<float> AlignedFloats;
+
+// Positions and velocities of every particle, one array per component
+template <typename Real> struct PhaseSpaceT {
+    AlignedArray<Real> x, y, z;
+    AlignedArray<Real> vx, vy, vz;
+
+    std::size_t size() const { return x.size(); }
+
+    void resize(std::size_t n) {
+        x.resize(n); y.resize(n); z.resize(n);
+        vx.resize(n); vy.resize(n); vz.resize(n);
+    }
+
+    Vec3<Real> position(std::size_t i) const { return Vec3<Real>(x[i], y[i], z[i]); }
+    Vec3<Real> velocity(std::size_t i) const { return Vec3<Real>(vx[i], vy[i], vz[i]); }
+};
+
+typedef PhaseSpaceT<float> PhaseSpace;
+
+// Contiguous structure-of-arrays store for every particle the engine steps
+// Motion is kept in the engine's precision, radius and spin are always float
+template <typename Real> class ParticleStoreT : public PhaseSpaceT<Real> {
+    public:
+        AlignedArray<Real> mass;
+        AlignedArray<Real> charge;
+        // Collision sphere radius, 0 for point particles
+        AlignedFloats radius;
+
+        // Rigid body orientation, world angular velocity and constant angular acceleration
+        AlignedFloats qw, qx, qy, qz;
+        AlignedFloats wx, wy, wz;
+        AlignedFloats alphaX, alphaY, alphaZ;
+
+        // Append a particle and return its index
+        std::size_t add(const Vec3<Real>& pos, const Vec3<Real>& vel, Real m, Real q, float r = 0) {
+            this->x.push_back(pos.x); this->y.push_back(pos.y); this->z.push_back(pos.z);
+            this->vx.push_back(vel.x); this->vy.push_back(vel.y); this->vz.push_back(vel.z);
+            mass.push_back(m);
+            charge.push_back(q);
+            radius.push_back(r);
+            qw.push_back(1); qx.push_back(0); qy.push_back(0); qz.push_back(0);
+            wx.push_back(0); wy.push_back(0); wz.push_back(0);
+            alphaX.push_back(0); alphaY.push_back(0); alphaZ.push_back(0);
+            return this->x.size() - 1;
+        }
+
+        void setSpin(std::size_t i, Vec3f angVel, Vec3f angAccel) {
+            wx[i] = angVel.x; wy[i] = angVel.y; wz[i] = angVel.z;
+            alphaX[i] = angAccel.x; alphaY[i] = angAccel.y; alphaZ[i] = angAccel.z;
+        }
+
+        Quaternion orientation(std::size_t i) const { return Quaternion(qw[i], qx[i], qy[i], qz[i]); }
+        Vec3f angularVelocity(std::size_t i) const { return Vec3f(wx[i], wy[i], wz[i]); }
+};
+
+typedef ParticleStoreT<float> ParticleStore;
+
+#endif // __PARTICLESTORE_H__
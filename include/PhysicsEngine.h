@@ -1,34 +1,29 @@
 #ifndef __PHYSICSENGINE_H__
 #define __PHYSICSENGINE_H__
 
-#include "Objects.h"
+#include "Vec3.h"
+#include "Octree.h"
+#include "ParticleMesh.h"
+#include "SpatialHash.h"
+#include "FieldGrid.h"
+#include "Expression.h"
+#include "ParticleStore.h"
+#include "ThreadPool.h"
+#include "PairKernel.h"
+#include "JSONReader.h"
+#include "Checkpoint.h"
+
+#include <memory>
 
 const float EpsilonNaught = 8.854e-12;
 const float ColoumbConstant = 1 / (4 * PI * EpsilonNaught);
 const float GravitationalConstant = 6.6743e-11;
 
-class PhysicsObject {
-    public:
-    Object* obj;
-    
-    float mass;
-    float charge;
-    
-    Vec3f velocity;
-    Vec3f acceleration;
-    Vec3f angularVelocity;
-    Vec3f angularAcceleration;
-    Vec3f rotation;
-    
-    
-    PhysicsObject(Object* o, float mass, float charge);
-    
-    void Rotate(float dt);
-
-    private: 
-        void updateRotation(Vec3f rot);
-    
-};
+// The same constants in the precision an engine steps in, double ones are rounded only once
+template <typename Real> const Real ColoumbConstantOf = Real(1 / (4 * 3.14159265358979323846 * 8.854e-12));
+template <typename Real> const Real GravitationalConstantOf = Real(6.6743e-11);
+template <> const float ColoumbConstantOf<float> = ColoumbConstant;
+template <> const float GravitationalConstantOf<float> = GravitationalConstant;
 
 class Field {
     public:
@@ -40,32 +35,265 @@ class Field {
         Type type;
         Vec3f direction;
         float strength;
-        Field(Type t, float str, Vec3f dir) : type(t), direction(dir.normalize()), strength(str) {};
+        Field(Type t, float str, Vec3f dir) : type(t), direction(dir.normalize()), strength(str), current(direction * str) {};
+        Field(const FieldModel& fieldM);
+
+        // Strength and direction given as expressions of t, x, y, z replace the numbers above
+        bool hasStrengthExpr = false;
+        bool hasDirectionExpr = false;
+        Expression strengthExpr;
+        Expression directionExpr[3];
+
+        // Grid fields sample a mapped vector grid (scaled by strength) instead of direction * strength
+        std::shared_ptr<const FieldGrid> grid;
+        int block = 0;
+
+        // Field vector at the last prepareForces: one for everyone, or per particle when it varies in space
+        Vec3f current;
+        bool sampled = false;
+        AlignedFloats sampleX, sampleY, sampleZ;
+
+        float strengthAt(float t, const Vec3f& p) const;
+        // Unit direction, zero where the direction expressions vanish
+        Vec3f directionAt(float t, const Vec3f& p) const;
+        bool dependsOnTime() const;
+        bool dependsOnPosition() const;
+
+        // Field vector acting on particle i
+        Vec3f at(int i) const {
+            return sampled ? Vec3f(sampleX[i], sampleY[i], sampleZ[i]) : current;
+        }
 };
 
+// Settings and the interface shared by every precision of the engine
+// Particles are stepped by a PhysicsEngineT<float> or PhysicsEngineT<double> picked at startup with create()
 class PhysicsEngine {
     public:
-        void integrateForward(const std::vector<PhysicsObject*> scene, const std::vector<Field> fields, float t, float dt);
-        void eulerRotate(const std::vector<PhysicsObject*> scene, float dt);
+        // How interparticle forces are summed
+        enum class ForceMethod {
+            AllPairs,
+            BarnesHut,
+            Tiled,
+            ParticleMesh
+        };
 
-    private:
+        // How particles are advanced through one integrateForward call
+        enum class Integrator {
+            RK4,
+            DormandPrince,
+            Boris,
+            BlockStep
+        };
+
+        // Float steps everything in float with the vector kernels, Double everything in double,
+        // Mixed keeps double positions, velocities and force sums but runs the float pair kernels
+        enum class Precision {
+            Float,
+            Double,
+            Mixed
+        };
 
-        struct State {
-            Vec3f r;
-            Vec3f v;
+        // Step counters of the adaptive integrator
+        struct StepStats {
+            long accepted = 0;
+            long rejected = 0;
+            float lastStep = 0;
+            // Per-particle force evaluations across every integrator
+            long forceEvaluations = 0;
+            // Sphere contacts resolved after steps
+            long contacts = 0;
         };
 
-        State getState(const PhysicsObject* p);
-        State stateAdd(const State& s, const State& d, float dt);
-        State evaluate(const std::vector<PhysicsObject*> scene, const std::vector<Field> fields, int i, const State& s, float t);
+        static std::unique_ptr<PhysicsEngine> create(Precision precision);
+        // Engine for the precision a scene's physics block asks for
+        static std::unique_ptr<PhysicsEngine> create(const PhysicsModel& physM);
+        virtual ~PhysicsEngine() = default;
+
+        ForceMethod forceMethod = ForceMethod::AllPairs;
+        // Barnes-Hut opening angle
+        float theta = 0.5f;
+
+        Integrator integrator = Integrator::RK4;
+        // Dormand-Prince error tolerances per component
+        float absTol = 1e-6f;
+        float relTol = 1e-5f;
+        StepStats stats;
+
+        // Block time-stepping: particle steps are dt / 2^level with level <= maxLevel
+        int maxLevel = 8;
+        // Accuracy parameter of the |a| / |da/dt| timestep criterion
+        float eta = 0.05f;
+
+        // Sphere collisions between bodies, resolved after every integrateForward call
+        bool collisions = false;
+        // Normal velocity kept after a contact: 1 is elastic, 0 perfectly inelastic
+        float restitution = 1.0f;
+
+        Precision getPrecision() const { return precision; }
+
+        // Forget integrator history (adaptive step size, block levels) after the state is changed externally
+        virtual void resetIntegrator() = 0;
+
+        // Scene loading: particles in object order, fields, then the physics block
+        virtual void loadSimulation(const Simulation* sim) = 0;
+        virtual void configure(const PhysicsModel& physM);
+
+        // Threads the stage loops are split across (0 uses every core)
+        void setThreadCount(unsigned threads);
+        unsigned threadCount();
+
+        // Pairwise kernel for the all-pairs sum, clamped to what the CPU supports
+        // Scalar keeps the reference computeColoumbForce + computeGravitationalForce loop
+        void setKernelPath(PairKernel::Path path);
+        PairKernel::Path getKernelPath() const { return kernelPath; }
+
+        // Advance every particle from t to t + dt
+        // Dormand-Prince takes as many internal steps as its tolerances need to get there
+        virtual void integrateForward(double t, double dt) = 0;
+
+        // Particle state widened to double whatever the engine runs at
+        virtual std::size_t particleCount() const = 0;
+        virtual Vec3d position(std::size_t i) const = 0;
+        virtual Vec3d velocity(std::size_t i) const = 0;
+        virtual double mass(std::size_t i) const = 0;
+        virtual double charge(std::size_t i) const = 0;
+        virtual Quaternion orientation(std::size_t i) const = 0;
+
+        // Positions rounded to float and orientations, for the renderer's snapshots
+        virtual void exportPose(AlignedFloats& x, AlignedFloats& y, AlignedFloats& z,
+                                AlignedFloats& qw, AlignedFloats& qx, AlignedFloats& qy, AlignedFloats& qz) const = 0;
+
+        // Every particle array and the integrator history, for checkpoints
+        // loadState replaces the particles of an engine already loaded from the same scene
+        virtual void saveState(Checkpoint::Writer& out) const = 0;
+        virtual void loadState(Checkpoint::Reader& in) = 0;
 
-        Vec3f computeForce(const std::vector<PhysicsObject*> scene, const std::vector<Field> fields, int i);
-        Vec3f computeColoumbForce(const PhysicsObject* target, const PhysicsObject* emitter);
-        Vec3f computeGravitationalForce(const PhysicsObject* target, const PhysicsObject* emitter);
-        Vec3f computeElectricFieldForce(const PhysicsObject* target, const Field E);
-        Vec3f computeMagneticFieldForce(const PhysicsObject* target, const Field B);
+    protected:
+        PhysicsEngine(Precision precision) : precision(precision) {}
+
+        Precision precision;
+
+        std::unique_ptr<ThreadPool> pool;
+        ThreadPool& workers();
+
+        PairKernel::Path kernelPath = PairKernel::detect();
+};
+
+// The engine stepping particles in Real (float or double)
+template <typename Real> class PhysicsEngineT : public PhysicsEngine {
+    public:
+        typedef Vec3<Real> Vec;
+        typedef PhaseSpaceT<Real> State;
+
+        PhysicsEngineT(Precision precision = Precision::Float);
+
+        // Every particle the engine steps and the fields acting on them
+        ParticleStoreT<Real> particles;
+        std::vector<Field> fields;
+
+        void resetIntegrator() override;
+        void loadSimulation(const Simulation* sim) override;
+        void configure(const PhysicsModel& physM) override;
+        void integrateForward(double t, double dt) override;
+
+        std::size_t particleCount() const override { return particles.size(); }
+        Vec3d position(std::size_t i) const override { return Vec3d(particles.position(i)); }
+        Vec3d velocity(std::size_t i) const override { return Vec3d(particles.velocity(i)); }
+        double mass(std::size_t i) const override { return particles.mass[i]; }
+        double charge(std::size_t i) const override { return particles.charge[i]; }
+        Quaternion orientation(std::size_t i) const override { return particles.orientation(i); }
+        void exportPose(AlignedFloats& x, AlignedFloats& y, AlignedFloats& z,
+                        AlignedFloats& qw, AlignedFloats& qx, AlignedFloats& qy, AlignedFloats& qz) const override;
+        void saveState(Checkpoint::Writer& out) const override;
+        void loadState(Checkpoint::Reader& in) override;
+
+    private:
+        // Mixed precision: pair sums run in float on a float copy of the positions
+        bool floatPairs;
+
+        // Stage states and derivatives, kept between steps to avoid reallocating
+        State k1, k2, k3, k4, k5, k6, k7;
+        State tempY, nextY;
+
+        void stepRK4(Real t, Real dt);
+
+        // Dormand-Prince 5(4) with FSAL, dpStep carries the step size between calls
+        void stepDormandPrince(Real t, Real dt);
+        Real dpStep = 0;
+        Real errorNorm(const State& y0, const State& y1, Real h);
+
+        // Hierarchical block time-stepping, levels and last accelerations persist between calls
+        void stepBlock(Real t, Real dt);
+        bool blockPrimed = false;
+        std::vector<int> blockLevel;
+        std::vector<int> activeList;
+        // Particles on each level, so ticks where nobody ends a step are skipped
+        std::vector<int> levelCount;
+        AlignedArray<Real> blockAx, blockAy, blockAz;
+        int chooseLevel(int i, const Vec& a, Real dtOld, Real dt);
+
+        // Boris velocity rotation for magnetic fields
+        void stepBoris(Real t, Real dt);
+        Vec magneticField(int i);
+        // v rotated about B by the gyro angle of a step h
+        static Vec gyrate(const Vec& v, const Vec& B, Real qm, Real h);
+        // Any field that has to be refreshed when positions or time move on
+        bool fieldsVary() const;
+        void updateFields(const State& y, float t);
+        std::vector<double> threadSums;
+
+        void stateAdd(const State& s, const State& d, Real dt, State& out);
+        // out = s + h * sum(a[j] * d[j]) over count derivatives
+        void stateCombine(const State& s, Real h, const Real* a, const State* const* d, int count, State& out);
+        void prepareForces(const State& y, Real t) { prepareForces(y, t, forceMethod); }
+        void prepareForces(const State& y, Real t, ForceMethod method);
+        void evaluateStage(const State& y, State& k, Real t);
+
+        // Positions of the stage being evaluated as float, for the tree, mesh, field grids and float kernels
+        // They point straight into the state when Real is float and into the shadow arrays otherwise
+        const float* stageX = nullptr;
+        const float* stageY = nullptr;
+        const float* stageZ = nullptr;
+        AlignedFloats shadowX, shadowY, shadowZ;
+        // Charges and masses as float, filled once when the scene loads
+        AlignedFloats chargeF, massF;
+        const float* floatCharges() const;
+        const float* floatMasses() const;
+        void floatPositions(const State& y);
+        void refreshFloatCopies();
+
+        // magnetic = false leaves out the velocity-dependent q v x B term
+        Vec computeForce(const State& y, int i, bool magnetic = true) { return computeForce(y, i, forceMethod, magnetic); }
+        Vec computeForce(const State& y, int i, ForceMethod method, bool magnetic = true);
+        Vec computeColoumbForce(const State& y, int target, int emitter);
+        Vec computeGravitationalForce(const State& y, int target, int emitter);
+        Vec computeElectricFieldForce(int target, const Field& E);
+        Vec computeMagneticFieldForce(const State& y, int target, const Field& B);
+
+        // Barnes-Hut tree, rebuilt from the stage positions before every RK4 stage
+        Octree tree;
+
+        // Particle-mesh field, solved from the stage positions before every RK4 stage
+        ParticleMesh mesh;
+
+        // Spin every rigid body's orientation through dt
+        void integrateRotation(float dt);
+
+        // Broadphase of the collision pass, rebuilt from the positions after every step
+        SpatialHash hash;
+        void resolveCollisions();
+
+        // Tiled symmetric all-pairs: per-thread accumulators and the reduced forces
+        void computeTiledForces(const State& y);
+        template <typename Pair> void computeTiledForcesIn(const Pair* x, const Pair* y, const Pair* z,
+                                                           const Pair* q, const Pair* m, std::size_t N);
+        AlignedArray<Real> threadForces;
+        AlignedArray<Real> tiledFx, tiledFy, tiledFz;
 };
 
+extern template class PhysicsEngineT<float>;
+extern template class PhysicsEngineT<double>;
+
 // State getState(PhysicsObject* p);
 // State stateAdd(const State& s, const Deriv& d, float dt);
 //  Deriv evaluate(int i, const std::vector<PhysicsObject*>& objects, const State& s, float t);
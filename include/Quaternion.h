@@ -0,0 +1,71 @@
+#ifndef __QUATERNION_H__
+#define __QUATERNION_H__
+
+#include <cmath>
+#include <string>
+
+#include "Vec3.h"
+#include "Matrix3.h"
+
+// Unit quaternion orientation, w + xi + yj + zk
+class Quaternion {
+    public:
+        float w, x, y, z;
+
+        // Class Constructors (identity by default)
+        Quaternion() : w(1), x(0), y(0), z(0) {}
+        Quaternion(float w, float x, float y, float z) : w(w), x(x), y(y), z(z) {}
+
+        // Rotation by |v| radians about v (the exponential map), identity for a zero vector
+        static Quaternion fromRotationVector(const Vec3f& v) {
+            float angle = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+            if (angle < 1e-12f)
+                return Quaternion(1, v.x * 0.5f, v.y * 0.5f, v.z * 0.5f).normalize();
+            float s = std::sin(angle * 0.5f) / angle;
+            return Quaternion(std::cos(angle * 0.5f), v.x * s, v.y * s, v.z * s);
+        }
+
+        // Operators
+        // Hamilton product, (a * b) applies b first and then a
+        inline Quaternion operator * (const Quaternion& q) const {
+            return Quaternion(w * q.w - x * q.x - y * q.y - z * q.z,
+                              w * q.x + x * q.w + y * q.z - z * q.y,
+                              w * q.y - x * q.z + y * q.w + z * q.x,
+                              w * q.z + x * q.y - y * q.x + z * q.w);
+        }
+
+        // Class Methods
+        float dot(const Quaternion& q) const { return w * q.w + x * q.x + y * q.y + z * q.z; }
+
+        Quaternion normalize() const {
+            float n = std::sqrt(dot(*this));
+            if (n == 0) return Quaternion();
+            float inv = 1 / n;
+            return Quaternion(w * inv, x * inv, y * inv, z * inv);
+        }
+
+        Quaternion conjugate() const { return Quaternion(w, -x, -y, -z); }
+
+        // Rotate a single vector, use toMatrix() for many
+        Vec3f rotate(const Vec3f& v) const { return toMatrix() * v; }
+
+        Matrix3 toMatrix() const {
+            float xx = x * x, yy = y * y, zz = z * z;
+            float xy = x * y, xz = x * z, yz = y * z;
+            float wx = w * x, wy = w * y, wz = w * z;
+            return Matrix3({1 - 2 * (yy + zz), 2 * (xy - wz), 2 * (xz + wy),
+                            2 * (xy + wz), 1 - 2 * (xx + zz), 2 * (yz - wx),
+                            2 * (xz - wy), 2 * (yz + wx), 1 - 2 * (xx + yy)});
+        }
+
+        // Normalized blend along the shorter arc, close enough to slerp for the small steps between snapshots
+        static Quaternion nlerp(const Quaternion& a, const Quaternion& b, float t) {
+            float s = (a.dot(b) < 0) ? -1.0f : 1.0f;
+            return Quaternion(a.w + (s * b.w - a.w) * t, a.x + (s * b.x - a.x) * t,
+                              a.y + (s * b.y - a.y) * t, a.z + (s * b.z - a.z) * t).normalize();
+        }
+
+        std::string toString() { return "(" + std::to_string(w) + ", " + std::to_string(x) + ", " + std::to_string(y) + ", " + std::to_string(z) + ")"; }
+};
+
+#endif // __QUATERNION_H__
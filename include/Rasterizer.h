@@ -0,0 +1,93 @@
+#ifndef __RASTERIZER_H__
+#define __RASTERIZER_H__
+
+#include <cstdint>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Corner of a triangle or line end in screen space
+struct RasterVertex {
+    // Pixel coordinates, y down
+    float x, y;
+    // Camera space depth, in front of the near plane
+    float z;
+    // Color channels 0..255
+    float r, g, b;
+};
+
+// CPU framebuffer with a depth buffer, drawn in any order and uploaded as one texture
+// Pixels are 0xAARRGGBB (SDL_PIXELFORMAT_ARGB8888) rows of width, top row first
+//
+// Triangles and lines are only set up when they are submitted. resolve() bins them into
+// TileSize square tiles and the pool's threads each fill whole tiles, so no two threads
+// touch the same pixel. Every tile draws its primitives in submission order, so the image
+// does not depend on the thread count.
+class Rasterizer {
+    public:
+        static const int TileSize = 64;
+
+        void resize(int width, int height);
+        // Start a frame on a background color, forgetting every primitive and depth
+        void clear(std::uint32_t color);
+
+        // Gouraud shaded triangle of either winding, kept per pixel where it is nearer than what is there
+        // Depth and colors are interpolated perspective correct through 1/z
+        void fillTriangle(const RasterVertex& a, const RasterVertex& b, const RasterVertex& c);
+        // One pixel wide line in a's color, depth tested like the triangles
+        void drawLine(const RasterVertex& a, const RasterVertex& b);
+
+        // Draw everything submitted since clear into the framebuffer
+        void resolve(ThreadPool& pool);
+
+        const std::uint32_t* pixels() const { return color.data(); }
+        int pitch() const { return width * static_cast<int>(sizeof(std::uint32_t)); }
+
+    private:
+        int width = 0;
+        int height = 0;
+        int tilesX = 0;
+        int tilesY = 0;
+        std::uint32_t background = 0;
+        std::vector<std::uint32_t> color;
+        // 1/z of the nearest surface so far, 0 where nothing was drawn
+        std::vector<float> depth;
+
+        // Everything a tile needs to fill its part of a triangle
+        struct TriangleSetup {
+            // Pixel bounds on screen, inclusive
+            int x0, y0, x1, y1;
+            // Edge k runs from (ex, ey) along (dx, dy), positive inside
+            float ex[3], ey[3], dx[3], dy[3];
+            bool topLeft[3];
+            float invArea;
+            // 1/z and color/z of each corner
+            float w[3], r[3], g[3], b[3];
+        };
+        // A line already cut to the screen, stepped from (xs, ys) in steps + 1 pixels
+        struct LineSetup {
+            int x0, y0, x1, y1;
+            float xs, ys, dx, dy;
+            float t0, t1;
+            float wa, wb;
+            int steps;
+            std::uint32_t color;
+        };
+
+        // Lines are marked in the submission order by this bit
+        static const std::uint32_t LineBit = 0x80000000u;
+        std::vector<TriangleSetup> triangles;
+        std::vector<LineSetup> lines;
+        std::vector<std::uint32_t> order;
+        // bins[binner][tile], one list per binning thread keeps binning lock free
+        // and the binners' contiguous ranges concatenate back into submission order
+        std::vector<std::vector<std::vector<std::uint32_t>>> bins;
+
+        void drawTile(int tile);
+        void triangleInTile(const TriangleSetup& t, int x0, int y0, int x1, int y1);
+        void lineInTile(const LineSetup& l, int x0, int y0, int x1, int y1);
+
+        static std::uint32_t pack(float r, float g, float b);
+};
+
+#endif // __RASTERIZER_H__
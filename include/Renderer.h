@@ -2,13 +2,16 @@
 #define __RENDERER_H__
 
 #include <array>
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 #include <SDL.h>
 #include "Vec3.h"
-#include "PhysicsEngine.h"
+#include "SimulationThread.h"
 #include "Objects.h"
 #include "JSONReader.h"
+#include "Rasterizer.h"
 
 // NXN refers to both unmapped and describes the number of mapped keys
 enum class Key {
@@ -72,6 +75,19 @@ class Renderer3D {
         SDL_Renderer* renderer;
         int width, height;
         float scale;
+
+        // Software mode draws into raster and uploads it to frame once per frame
+        bool software;
+        Rasterizer raster;
+        // Threads raster bins and fills tiles with, only made in software mode
+        std::unique_ptr<ThreadPool> rasterPool;
+        SDL_Texture* frame = nullptr;
+        // Color of the lines drawn next
+        SDL_Color lineColor = {255, 255, 255, 255};
+        // Geometry mode collects the frame's triangles and lines in draw order and hands them to SDL in one call
+        // Cleared every frame but never shrunk, so steady frames allocate nothing
+        std::vector<SDL_Vertex> batchVerts;
+        std::vector<int> batchIndices;
         
         // Lighting/Shading 
         Vec3f lightDir;
@@ -80,50 +96,101 @@ class Renderer3D {
         float specWeight;
         float shininess;
         float gamma;
+        // pow(x, shininess) and pow(x, 1/gamma) sampled at ShadeSteps points of [0, 1]
+        static const int ShadeSteps = 1024;
+        std::vector<float> specTable;
+        std::vector<float> gammaTable;
         
         // Holds all objects of the scene
         std::vector<PhysicsObject*> scene;
-        std::vector<Field> fields;
+        // Vertex stage output, all buffers are reused across objects and frames
+        // World space vertices of the object being drawn
+        std::vector<Vec3f> worldVerts;
+        // Every drawn object's vertices of the frame, one after the other
+        std::vector<Vec3f> camVerts;
+        // Screen position (valid in front of the near plane), depth and lit color
+        std::vector<RasterVertex> screenVerts;
+        // Set for vertices of the object being drawn whose triangles survived culling, only those are lit
+        std::vector<unsigned char> vertexUsed;
+
+        // Triangle stage output of the whole frame, indices into camVerts and screenVerts
+        struct RenderTri { int v[3]; };
+        std::vector<RenderTri> renderList;
+        // Wireframe and crosshair lines of the geometry backend
+        struct RenderLine { ProjPos p1, p2; SDL_Color color; };
+        std::vector<RenderLine> lineList;
+        // Painter's order of the geometry backend: a depth key per triangle or line (marked by LineBit),
+        // radix sorted once per frame through the sort buffers
+        static const std::uint32_t LineBit = 0x80000000u;
+        std::vector<std::uint32_t> drawKeys;
+        std::vector<std::uint32_t> drawIds;
+        std::vector<std::uint32_t> sortKeys;
+        std::vector<std::uint32_t> sortIds;
+        // Every sphere level, built once when the scene loads
+        std::array<std::shared_ptr<const Mesh>, MeshLibrary::MaxLevel + 1> sphereLevels;
         Camera cam;
         std::vector<bool> key_map;
 
-        // Physics Handler
-        PhysicsEngine phyeng;
+        // Physics runs on its own thread, frames read its snapshots
+        SimulationThread simThread;
         
         // Initialization
         void loadScene();
-        PhysicsObject* loadObjectModel(ObjectModel objM);
-        Field loadFieldModel(FieldModel fieldM);
+        PhysicsObject* loadObjectModel(ObjectModel objM, std::size_t index);
 
         // Render current frame
         void renderFrame();
+        void syncObject(PhysicsObject* Pobj, float alpha);
 
         // Depth Consideration Functions
-        // These functions sort scene in display order based on center of objects (not perfect but it's enough)
-        void sortScene(int L, int R);
-        void sortSceneMerge(int L, int R, int mid);
-        bool isInFront(const Object* A, const Object* B);
+        // Triangles and lines of all objects are sorted together, so bodies reaching into each other draw right
+        void drawSorted();
+        void sortDrawList();
+        static std::uint32_t depthKey(float z);
 
         // Projection Functions
         // World Space => Camera Space => Screen Space
         Vec3f worldToCam(const Vec3f& point);
         ProjPos camToScreen(const Vec3f& C);
+        // Sub-pixel screen position of a point in front of the near plane, with the color of shaded
+        RasterVertex camToRaster(const Vec3f& C, const RasterVertex& shaded);
 
         // Draw functions
         void drawPoint(const Vec3f& point);
         void drawLine(const Vec3f& point1, const Vec3f& point2);
+        void drawCamLine(Vec3f C1, Vec3f C2);
         void drawCrosshair();
         void drawObject(const Object* obj);
+        // Swap a sphere's mesh for the level that suits its size on screen
+        void chooseDetail(Object* obj);
+
+        // Whole objects outside the view are skipped before any of their vertices are touched
+        bool inFrustum(const Object* obj);
 
-        // Fill functions
-        void geometryObjectFill(const Object* obj);
+        // Vertex stage, each mesh vertex is transformed, and for filled objects projected and lit, at most once
+        std::size_t transformVertices(const Object* obj);
+        void projectVertices(std::size_t base);
+        void shadeVertices(const Object* obj, std::size_t base);
+        void buildShadingTables();
+        float lookup(const std::vector<float>& table, float x) const;
+
+        // Triangle stage, culls back faces and off screen triangles, then assembles and clips what the vertex stage produced
+        void geometryObjectFill(const Object* obj, std::size_t base);
         // Helper fill functions
-        std::vector<std::array<Vec3f, 3>> clipAgainstNearPlane(const Vec3f& A, const Vec3f& B, const Vec3f& C);
-        bool allVertsOutside(std::array<ProjPos, 3> ndc);
+        void clipAndFill(const RenderTri& tri);
+        void fillCorners(const RasterVertex corners[3]);
+        int clipAgainstNearPlane(const Vec3f& A, const Vec3f& B, const Vec3f& C, std::array<std::array<Vec3f, 3>, 2>& out);
+        bool allVertsOutside(const RasterVertex corners[3]);
 
         // Color helper function
         void setDrawColor(SDL_Color color);
 
+        // Batch helper functions
+        void batchTriangle(const RasterVertex corners[3]);
+        // A line becomes a one pixel wide quad so it shares the triangles' draw call
+        void batchLine(ProjPos p1, ProjPos p2, SDL_Color color);
+        void flushBatch();
+
         
         // Camera Functions
         void rotateCam(SDL_Event* e, int* lastX, int* lastY);
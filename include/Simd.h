@@ -0,0 +1,25 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+// Shared setup for the hand-vectorized kernels, include from .cpp files only
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define EMSIM_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+#else
+    #define EMSIM_X86 0
+#endif
+
+// GCC and Clang need the ISA enabled per function, MSVC accepts the intrinsics anywhere
+#if EMSIM_X86 && (defined(__GNUC__) || defined(__clang__))
+    #define EMSIM_TARGET_AVX2 __attribute__((target("avx2,fma")))
+    #define EMSIM_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+    #define EMSIM_TARGET_AVX2
+    #define EMSIM_TARGET_AVX512
+#endif
+
+#endif // __SIMD_H__
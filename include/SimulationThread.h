@@ -0,0 +1,75 @@
+#ifndef __SIMULATIONTHREAD_H__
+#define __SIMULATIONTHREAD_H__
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "Vec3.h"
+#include "ParticleStore.h"
+#include "PhysicsEngine.h"
+#include "JSONReader.h"
+
+// Particle positions and orientations published by the simulation thread
+struct Snapshot {
+    double time = 0;
+    long step = -1;
+    std::chrono::steady_clock::time_point published;
+    AlignedFloats x, y, z;
+    AlignedFloats qw, qx, qy, qz;
+};
+
+// Steps the physics engine on its own thread with a fixed-step accumulator
+// The renderer never waits on it: finished steps are handed over through a lock free triple buffer
+class SimulationThread {
+    public:
+        SimulationThread(Simulation* sim);
+        ~SimulationThread();
+
+        // Load the scene into the engine (or the checkpoint it restarts from), publish the initial state and start stepping
+        void start();
+        // Stop stepping, and write the final checkpoint if the run keeps one
+        void stop();
+
+        // Take the newest published snapshot if there is one, returns true when it changed
+        // Only the render thread may call this and the read functions below
+        bool acquire();
+
+        const Snapshot& latest() const { return slots[front]; }
+        const Snapshot& previous() const { return prev; }
+
+        // How far the render clock is between the previous and latest snapshot (0..1)
+        float blend(std::chrono::steady_clock::time_point now) const;
+        // Position of particle i blended between the last two snapshots
+        Vec3f position(std::size_t i, float alpha) const;
+        // Orientation of particle i blended the same way
+        Quaternion orientation(std::size_t i, float alpha) const;
+
+    private:
+        Simulation* sim;
+        std::unique_ptr<PhysicsEngine> engine;
+        float dt;
+        // Clock of the stepper, only touched by the worker while it runs
+        double simTime = 0.0;
+        long step = 0;
+
+        std::thread worker;
+        std::atomic<bool> quit;
+
+        // Writer owns slots[back], reader owns slots[front], the third is parked in ready
+        // FreshBit marks a parked slot the reader has not taken yet
+        static constexpr int FreshBit = 4;
+        Snapshot slots[3];
+        int back;
+        int front;
+        std::atomic<int> ready;
+        // Reader side copy of the snapshot before front, for interpolation
+        Snapshot prev;
+
+        void loop();
+        void publish(double simTime, long step);
+        void saveCheckpoint();
+};
+
+#endif // __SIMULATIONTHREAD_H__
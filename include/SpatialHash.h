@@ -0,0 +1,46 @@
+#ifndef __SPATIALHASH_H__
+#define __SPATIALHASH_H__
+
+#include <vector>
+#include <cstdint>
+
+#include "ThreadPool.h"
+
+// Uniform grid broadphase for sphere contacts
+// Cells are as wide as the largest diameter, so overlapping spheres always sit in neighbouring cells.
+// Cell coordinates are hashed into a table sized by the sphere count, not by the extent of the scene.
+class SpatialHash {
+    public:
+        struct Contact {
+            int i, j;
+        };
+
+        // Rebuild around n spheres given as separate coordinate and radius arrays
+        void build(const float* x, const float* y, const float* z, const float* radius, int n, ThreadPool& pool);
+
+        // Every overlapping pair with i < j, ordered by i then j
+        const std::vector<Contact>& findContacts(ThreadPool& pool);
+
+    private:
+        const float* x = nullptr;
+        const float* y = nullptr;
+        const float* z = nullptr;
+        const float* radius = nullptr;
+        int count = 0;
+
+        float invCell = 0;
+        std::uint32_t mask = 0;
+
+        // Bucket of every sphere (mask + 1 for spheres left out), then the spheres sorted by bucket
+        std::vector<std::uint32_t> bucket;
+        std::vector<int> bucketStart;
+        std::vector<int> sorted;
+
+        std::vector<std::vector<Contact>> threadContacts;
+        std::vector<Contact> contacts;
+
+        std::int64_t cellOf(float p) const;
+        std::uint32_t hash(std::int64_t cx, std::int64_t cy, std::int64_t cz) const;
+};
+
+#endif // __SPATIALHASH_H__
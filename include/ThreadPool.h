@@ -0,0 +1,49 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstddef>
+
+// Persistent worker threads that split index ranges into fixed chunks
+class ThreadPool {
+    public:
+        typedef std::function<void(std::size_t begin, std::size_t end, unsigned worker)> RangeFn;
+
+        // 0 threads uses every hardware thread
+        ThreadPool(unsigned threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator = (const ThreadPool&) = delete;
+
+        // Number of threads work is split across (including the caller)
+        unsigned size() const { return threadCount; }
+
+        // Run fn over [0, n) split into size() contiguous chunks and wait for all of them
+        // Chunk boundaries depend only on n and size(), so results are reproducible
+        void parallelFor(std::size_t n, const RangeFn& fn);
+
+    private:
+        unsigned threadCount;
+        std::vector<std::thread> workers;
+
+        std::mutex mtx;
+        std::condition_variable wake;
+        std::condition_variable done;
+
+        // Current job, guarded by mtx
+        const RangeFn* job = nullptr;
+        std::size_t jobSize = 0;
+        unsigned generation = 0;
+        unsigned pending = 0;
+        bool stopping = false;
+
+        void workerLoop(unsigned worker);
+        void runChunk(const RangeFn& fn, std::size_t n, unsigned worker);
+};
+
+#endif // __THREADPOOL_H__
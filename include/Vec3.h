@@ -4,6 +4,8 @@
 #include <cmath>
 #include <string>
 
+const float PI = static_cast<float>( 4 * std::atan(1.0));
+
 template <typename t> class Vec3 {
     public:
         t x, y, z;
@@ -11,6 +13,8 @@ template <typename t> class Vec3 {
         // Class Constructors
         Vec3() {x=0; y=0; z=0;}
         Vec3(t _x, t _y, t _z) {x = _x; y = _y; z = _z;}
+        // Precision conversion, e.g. Vec3d(v) from a Vec3f
+        template <typename u> explicit Vec3(const Vec3<u>& V) {x = static_cast<t>(V.x); y = static_cast<t>(V.y); z = static_cast<t>(V.z);}
 
         // Operators
         inline Vec3<t> operator + (const Vec3<t> &V) const { return Vec3<t>(x + V.x, y + V.y, z + V.z); }
@@ -24,7 +28,7 @@ template <typename t> class Vec3 {
 
         t magnitude(){ return sqrt(this->x * this->x + this->y * this->y + this->z * this->z); }
 
-        Vec3<t> normalize() { return (*this * (float) (1 / this->magnitude())); }
+        Vec3<t> normalize() { return (*this * (t) (1 / this->magnitude())); }
 
         std::string toString(){ return "("+std::to_string(this->x)+", "+std::to_string(this->y)+", "+std::to_string(this->z)+")"; }
 
@@ -38,6 +42,7 @@ template <typename t> class Vec3 {
 };
 
 typedef Vec3<float> Vec3f;
+typedef Vec3<double> Vec3d;
 typedef Vec3<int> Vec3i;
 
 #endif // __Vec3_H__
\ No newline at end of file
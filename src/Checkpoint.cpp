@@ -0,0 +1,281 @@
+#include "Checkpoint.h"
+
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+#include "JSONReader.h"
+#include "PhysicsEngine.h"
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+// Push a written file through to the disk, so the rename cannot land before its contents
+static bool syncFile(const std::string& path) {
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+    bool synced = FlushFileBuffers(handle) != 0;
+    CloseHandle(handle);
+    return synced;
+#else
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd < 0) return false;
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+#endif
+}
+
+// Enumerator stored as int32, anything outside [0, last] is rejected
+template <typename E> static E getEnum(Checkpoint::Reader& in, E last, const char* what) {
+    std::int32_t value = in.get<std::int32_t>();
+    if (value < 0 || value > static_cast<std::int32_t>(last))
+        in.fail(std::string("unknown ") + what + " " + std::to_string(value));
+    return static_cast<E>(value);
+}
+
+void Checkpoint::write(const std::string& path, const Simulation& sim, const PhysicsEngine& engine, double time, long step) {
+    const std::string temp = path + ".tmp";
+    {
+        std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+            throw std::runtime_error("Could not create checkpoint: " + temp);
+
+        Writer out(file);
+        file.write("EMCK", 4);
+        out.put(Version);
+        out.put(time);
+        out.put<std::int64_t>(step);
+        writeScene(out, sim);
+        engine.saveState(out);
+
+        file.close();
+        if (!file)
+            throw std::runtime_error("Could not write checkpoint: " + temp);
+    }
+    if (!syncFile(temp))
+        throw std::runtime_error("Could not flush checkpoint to disk: " + temp);
+
+    // Readers see either the old file or the complete new one, never a partial write
+    std::error_code error;
+    std::filesystem::rename(temp, path, error);
+    if (error)
+        throw std::runtime_error("Could not replace checkpoint " + path + ": " + error.message());
+}
+
+std::shared_ptr<const Checkpoint> Checkpoint::open(const std::string& path, Simulation& sim) {
+    std::shared_ptr<Checkpoint> ckpt(new Checkpoint());
+    ckpt->path = path;
+    if (!ckpt->file.open(path))
+        throw std::runtime_error("Could not map checkpoint: " + path);
+
+    Reader in(ckpt->file.data(), ckpt->file.size(), 0, path);
+    char magic[4];
+    for (char& c : magic)
+        c = in.get<char>();
+    if (std::memcmp(magic, "EMCK", 4) != 0)
+        in.fail("not an EMCK checkpoint");
+    std::uint32_t version = in.get<std::uint32_t>();
+    if (version != Version)
+        in.fail("unsupported version " + std::to_string(version));
+
+    ckpt->time = in.get<double>();
+    ckpt->step = static_cast<long>(in.get<std::int64_t>());
+    readScene(in, sim);
+
+    ckpt->objectCount = sim.objModels.size();
+    ckpt->stateOffset = in.offset();
+    return ckpt;
+}
+
+void Checkpoint::restore(PhysicsEngine& engine) const {
+    Reader in(file.data(), file.size(), stateOffset, path);
+    engine.loadState(in);
+    if (engine.particleCount() != objectCount)
+        in.fail(std::to_string(engine.particleCount()) + " particles for " + std::to_string(objectCount) + " objects");
+}
+
+/*******************************************************************
+                        SCENE
+********************************************************************/
+
+// Everything the JSON scene describes, so a restart does not need it
+void Checkpoint::writeScene(Writer& out, const Simulation& sim) {
+    out.putString(sim.name);
+
+    out.put<std::int32_t>(sim.width);
+    out.put<std::int32_t>(sim.height);
+    out.put(sim.scale);
+    out.put<std::int32_t>(sim.renderMode);
+    out.put<std::int32_t>(sim.renderThreads);
+
+    out.put(sim.distance);
+    out.put(sim.rotateSpeed);
+    out.put(sim.panSpeed);
+    out.put(sim.zoomSpeed);
+    out.put(sim.focalLength);
+    out.put(sim.near);
+
+    out.put(sim.lightDir);
+    out.put(sim.ambient);
+    out.put(sim.diffWeight);
+    out.put(sim.specWeight);
+    out.put(sim.shininess);
+    out.put(sim.gamma);
+
+    const PhysicsModel& physM = sim.physicsModel;
+    out.put<std::int32_t>(physM.forceMethod);
+    out.put<std::int32_t>(physM.simd);
+    out.put<std::int32_t>(physM.precision);
+    out.put<std::int32_t>(physM.integrator);
+    out.put(physM.absTol);
+    out.put(physM.relTol);
+    out.put<std::int32_t>(physM.maxLevel);
+    out.put(physM.eta);
+    out.put(physM.theta);
+    out.put<std::int32_t>(physM.pmGrid);
+    out.put<std::int32_t>(physM.pmBoundary);
+    out.put(physM.pmBox);
+    out.put<std::uint8_t>(physM.p3m);
+    out.put(physM.p3mSplit);
+    out.put<std::uint8_t>(physM.collisions);
+    out.put(physM.restitution);
+    out.put<std::int32_t>(physM.threads);
+
+    const RunModel& runM = sim.runModel;
+    out.put<std::uint8_t>(runM.headless);
+    out.put<std::int32_t>(runM.steps);
+    out.put(runM.endTime);
+    out.put(runM.dt);
+    out.put<std::uint8_t>(runM.interpolate);
+    out.putString(runM.output);
+    out.putString(runM.checkpoint);
+    out.put<std::int32_t>(runM.checkpointEvery);
+
+    out.put<std::uint64_t>(sim.objModels.size());
+    for (const ObjectModel& objM : sim.objModels) {
+        out.putString(objM.name);
+        out.put<std::int32_t>(objM.shape);
+        out.put(objM.center);
+        out.put(objM.radius);
+        out.put(objM.color);
+        out.put<std::uint8_t>(objM.wireframe);
+        out.put(objM.mass);
+        out.put(objM.charge);
+        out.put(objM.initVelocity);
+        out.put(objM.initAccel);
+        out.put(objM.initAngVelocity);
+        out.put(objM.initAngAccel);
+    }
+
+    out.put<std::uint64_t>(sim.fieldModels.size());
+    for (const FieldModel& fieldM : sim.fieldModels) {
+        out.putString(fieldM.name);
+        out.put<std::int32_t>(fieldM.type);
+        out.put(fieldM.direction);
+        out.put(fieldM.strength);
+        out.putString(fieldM.strengthExpr);
+        for (int c = 0; c < 3; c++)
+            out.putString(fieldM.directionExpr[c]);
+        out.putString(fieldM.grid);
+        out.put<std::int32_t>(fieldM.gridBlock);
+    }
+}
+
+void Checkpoint::readScene(Reader& in, Simulation& sim) {
+    sim.name = in.getString();
+
+    sim.width = in.get<std::int32_t>();
+    sim.height = in.get<std::int32_t>();
+    sim.scale = in.get<float>();
+    sim.renderMode = getEnum(in, Simulation::Software, "render mode");
+    sim.renderThreads = in.get<std::int32_t>();
+
+    sim.distance = in.get<float>();
+    sim.rotateSpeed = in.get<float>();
+    sim.panSpeed = in.get<float>();
+    sim.zoomSpeed = in.get<float>();
+    sim.focalLength = in.get<float>();
+    sim.near = in.get<float>();
+
+    sim.lightDir = in.get<Vec3f>();
+    sim.ambient = in.get<float>();
+    sim.diffWeight = in.get<float>();
+    sim.specWeight = in.get<float>();
+    sim.shininess = in.get<float>();
+    sim.gamma = in.get<float>();
+
+    PhysicsModel& physM = sim.physicsModel;
+    physM.forceMethod = getEnum(in, PhysicsModel::ParticleMesh, "force method");
+    physM.simd = getEnum(in, PhysicsModel::AVX512, "SIMD path");
+    physM.precision = getEnum(in, PhysicsModel::Mixed, "precision");
+    physM.integrator = getEnum(in, PhysicsModel::BlockStep, "integrator");
+    physM.absTol = in.get<float>();
+    physM.relTol = in.get<float>();
+    physM.maxLevel = in.get<std::int32_t>();
+    physM.eta = in.get<float>();
+    physM.theta = in.get<float>();
+    physM.pmGrid = in.get<std::int32_t>();
+    physM.pmBoundary = getEnum(in, PhysicsModel::Periodic, "PM boundary");
+    physM.pmBox = in.get<float>();
+    physM.p3m = in.get<std::uint8_t>() != 0;
+    physM.p3mSplit = in.get<float>();
+    physM.collisions = in.get<std::uint8_t>() != 0;
+    physM.restitution = in.get<float>();
+    physM.threads = in.get<std::int32_t>();
+
+    RunModel& runM = sim.runModel;
+    runM.headless = in.get<std::uint8_t>() != 0;
+    runM.steps = in.get<std::int32_t>();
+    runM.endTime = in.get<float>();
+    runM.dt = in.get<float>();
+    runM.interpolate = in.get<std::uint8_t>() != 0;
+    runM.output = in.getString();
+    runM.checkpoint = in.getString();
+    runM.checkpointEvery = in.get<std::int32_t>();
+
+    std::uint64_t objects = in.get<std::uint64_t>();
+    sim.objModels.clear();
+    for (std::uint64_t i = 0; i < objects; i++) {
+        ObjectModel objM;
+        objM.name = in.getString();
+        objM.shape = getEnum(in, ObjectModel::CUBE, "shape");
+        objM.center = in.get<Vec3d>();
+        objM.radius = in.get<float>();
+        objM.color = in.get<ObjectModel::Color>();
+        objM.wireframe = in.get<std::uint8_t>() != 0;
+        objM.mass = in.get<double>();
+        objM.charge = in.get<double>();
+        objM.initVelocity = in.get<Vec3d>();
+        objM.initAccel = in.get<Vec3f>();
+        objM.initAngVelocity = in.get<Vec3f>();
+        objM.initAngAccel = in.get<Vec3f>();
+        sim.objModels.push_back(objM);
+    }
+
+    std::uint64_t fields = in.get<std::uint64_t>();
+    sim.fieldModels.clear();
+    for (std::uint64_t i = 0; i < fields; i++) {
+        FieldModel fieldM;
+        fieldM.name = in.getString();
+        fieldM.type = getEnum(in, FieldModel::Magnetic, "field type");
+        fieldM.direction = in.get<Vec3f>();
+        fieldM.strength = in.get<float>();
+        fieldM.strengthExpr = in.getString();
+        for (int c = 0; c < 3; c++)
+            fieldM.directionExpr[c] = in.getString();
+        fieldM.grid = in.getString();
+        fieldM.gridBlock = in.get<std::int32_t>();
+        sim.fieldModels.push_back(fieldM);
+    }
+
+    sim.loadedSuccess = true;
+}
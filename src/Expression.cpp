@@ -0,0 +1,258 @@
+#include "Expression.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "Vec3.h"
+
+Expression::Expression(const std::string& text) : text(text) {
+    pos = 0;
+    int root = parseSum();
+    skipSpaces();
+    if (pos != text.size())
+        fail("unexpected '" + std::string(1, text[pos]) + "'");
+
+    int maxDepth = 0;
+    emit(root, 0, maxDepth);
+    if (maxDepth > MaxStack)
+        fail("too deeply nested");
+
+    nodes.clear();
+    nodes.shrink_to_fit();
+}
+
+float Expression::evaluate(float t, float x, float y, float z) const {
+    float stack[MaxStack];
+    int top = -1;
+
+    for (const Instr& in : code) {
+        switch (in.op)
+        {
+            case Op::Const: stack[++top] = in.value; break;
+            case Op::T: stack[++top] = t; break;
+            case Op::X: stack[++top] = x; break;
+            case Op::Y: stack[++top] = y; break;
+            case Op::Z: stack[++top] = z; break;
+
+            case Op::Add: top--; stack[top] += stack[top + 1]; break;
+            case Op::Sub: top--; stack[top] -= stack[top + 1]; break;
+            case Op::Mul: top--; stack[top] *= stack[top + 1]; break;
+            case Op::Div: top--; stack[top] /= stack[top + 1]; break;
+            case Op::Pow: case Op::Min: case Op::Max: case Op::Atan2:
+                top--;
+                stack[top] = apply(in.op, stack[top], stack[top + 1]);
+                break;
+
+            case Op::Neg: stack[top] = -stack[top]; break;
+            case Op::Square: stack[top] *= stack[top]; break;
+            default:
+                stack[top] = apply(in.op, stack[top], 0);
+                break;
+        }
+    }
+
+    return stack[0];
+}
+
+/*******************************************************************
+                        PARSER
+********************************************************************/
+
+// sum := product (('+' | '-') product)*
+int Expression::parseSum() {
+    int left = parseProduct();
+    while (true) {
+        if (accept('+')) left = make(Op::Add, left, parseProduct());
+        else if (accept('-')) left = make(Op::Sub, left, parseProduct());
+        else return left;
+    }
+}
+
+// product := unary (('*' | '/') unary)*
+int Expression::parseProduct() {
+    int left = parseUnary();
+    while (true) {
+        if (accept('*')) left = make(Op::Mul, left, parseUnary());
+        else if (accept('/')) left = make(Op::Div, left, parseUnary());
+        else return left;
+    }
+}
+
+// unary := ('-' | '+') unary | power
+int Expression::parseUnary() {
+    if (accept('-')) return make(Op::Neg, parseUnary());
+    if (accept('+')) return parseUnary();
+    return parsePower();
+}
+
+// power := primary ('^' unary)?, right associative and binding tighter than unary minus on its left
+int Expression::parsePower() {
+    int base = parsePrimary();
+    if (accept('^')) return make(Op::Pow, base, parseUnary());
+    return base;
+}
+
+// primary := number | variable | constant | function '(' args ')' | '(' sum ')'
+int Expression::parsePrimary() {
+    skipSpaces();
+    if (pos >= text.size())
+        fail("expression ends early");
+
+    if (accept('(')) {
+        int inner = parseSum();
+        expect(')');
+        return inner;
+    }
+
+    char c = text[pos];
+    if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+        const char* start = text.c_str() + pos;
+        char* end = nullptr;
+        float value = std::strtof(start, &end);
+        if (end == start)
+            fail("bad number");
+        pos += end - start;
+        return make(Op::Const, -1, -1, value);
+    }
+
+    if (!std::isalpha(static_cast<unsigned char>(c)))
+        fail("unexpected '" + std::string(1, c) + "'");
+
+    std::size_t start = pos;
+    while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_'))
+        pos++;
+    std::string name = text.substr(start, pos - start);
+
+    if (name == "t") { usesTime = true; return make(Op::T); }
+    if (name == "x") { usesPosition = true; return make(Op::X); }
+    if (name == "y") { usesPosition = true; return make(Op::Y); }
+    if (name == "z") { usesPosition = true; return make(Op::Z); }
+    if (name == "pi") return make(Op::Const, -1, -1, PI);
+    if (name == "e") return make(Op::Const, -1, -1, std::exp(1.0f));
+
+    static const struct { const char* name; Op op; } functions[] = {
+        {"sin", Op::Sin}, {"cos", Op::Cos}, {"tan", Op::Tan}, {"exp", Op::Exp}, {"log", Op::Log},
+        {"sqrt", Op::Sqrt}, {"abs", Op::Abs}, {"tanh", Op::Tanh}, {"floor", Op::Floor},
+        {"min", Op::Min}, {"max", Op::Max}, {"pow", Op::Pow}, {"atan2", Op::Atan2}
+    };
+    for (const auto& f : functions) {
+        if (name != f.name) continue;
+
+        expect('(');
+        int a = parseSum();
+        int b = -1;
+        if (arity(f.op) == 2) {
+            expect(',');
+            b = parseSum();
+        }
+        expect(')');
+        return make(f.op, a, b);
+    }
+
+    fail("unknown name '" + name + "'");
+}
+
+void Expression::skipSpaces() {
+    while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+        pos++;
+}
+
+bool Expression::accept(char c) {
+    skipSpaces();
+    if (pos < text.size() && text[pos] == c) {
+        pos++;
+        return true;
+    }
+    return false;
+}
+
+void Expression::expect(char c) {
+    if (!accept(c))
+        fail("expected '" + std::string(1, c) + "'");
+}
+
+void Expression::fail(const std::string& message) const {
+    throw std::runtime_error("Expression \"" + text + "\": " + message + " at " + std::to_string(pos));
+}
+
+/*******************************************************************
+                        FOLDING AND CODE
+********************************************************************/
+
+int Expression::make(Op op, int a, int b, float value) {
+    const bool constA = (a < 0) || nodes[a].op == Op::Const;
+    const bool constB = (b < 0) || nodes[b].op == Op::Const;
+
+    if (op != Op::Const && arity(op) > 0 && constA && constB) {
+        value = apply(op, nodes[a].value, b >= 0 ? nodes[b].value : 0);
+        op = Op::Const;
+        a = b = -1;
+    } else if (op == Op::Pow && b >= 0 && nodes[b].op == Op::Const && nodes[b].value == 2) {
+        // The common square skips powf
+        op = Op::Square;
+        b = -1;
+    } else if (b >= 0 && nodes[b].op == Op::Const) {
+        // x + 0, x - 0, x * 1, x / 1, x ^ 1 are just x
+        float v = nodes[b].value;
+        if (((op == Op::Add || op == Op::Sub) && v == 0) || ((op == Op::Mul || op == Op::Div || op == Op::Pow) && v == 1))
+            return a;
+    } else if (a >= 0 && b >= 0 && nodes[a].op == Op::Const) {
+        float v = nodes[a].value;
+        if ((op == Op::Add && v == 0) || (op == Op::Mul && v == 1))
+            return b;
+    }
+
+    nodes.push_back({op, value, a, b});
+    return static_cast<int>(nodes.size()) - 1;
+}
+
+// Post-order walk: operands first, then the operator
+void Expression::emit(int node, int depth, int& maxDepth) {
+    const Node& n = nodes[node];
+    if (n.a >= 0) emit(n.a, depth, maxDepth);
+    if (n.b >= 0) emit(n.b, depth + 1, maxDepth);
+    if (arity(n.op) == 0 && depth + 1 > maxDepth)
+        maxDepth = depth + 1;
+    code.push_back({n.op, n.value});
+}
+
+float Expression::apply(Op op, float a, float b) {
+    switch (op)
+    {
+        case Op::Add: return a + b;
+        case Op::Sub: return a - b;
+        case Op::Mul: return a * b;
+        case Op::Div: return a / b;
+        case Op::Pow: return std::pow(a, b);
+        case Op::Min: return std::fmin(a, b);
+        case Op::Max: return std::fmax(a, b);
+        case Op::Atan2: return std::atan2(a, b);
+        case Op::Neg: return -a;
+        case Op::Square: return a * a;
+        case Op::Sin: return std::sin(a);
+        case Op::Cos: return std::cos(a);
+        case Op::Tan: return std::tan(a);
+        case Op::Exp: return std::exp(a);
+        case Op::Log: return std::log(a);
+        case Op::Sqrt: return std::sqrt(a);
+        case Op::Abs: return std::fabs(a);
+        case Op::Tanh: return std::tanh(a);
+        case Op::Floor: return std::floor(a);
+        default: return 0;
+    }
+}
+
+int Expression::arity(Op op) {
+    switch (op)
+    {
+        case Op::Const: case Op::T: case Op::X: case Op::Y: case Op::Z:
+            return 0;
+        case Op::Add: case Op::Sub: case Op::Mul: case Op::Div:
+        case Op::Pow: case Op::Min: case Op::Max: case Op::Atan2:
+            return 2;
+        default:
+            return 1;
+    }
+}
@@ -0,0 +1,205 @@
+#include "FieldGrid.h"
+
+#include <algorithm>
+#include <cstring>
+#include <climits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+#include "Simd.h"
+
+// Every field naming the same file shares one mapping; entries expire with their last user
+static std::mutex cacheMutex;
+static std::map<std::string, std::weak_ptr<const FieldGrid>> cache;
+
+std::shared_ptr<const FieldGrid> FieldGrid::open(const std::string& path) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    auto found = cache.find(path);
+    if (found != cache.end())
+        if (std::shared_ptr<const FieldGrid> shared = found->second.lock())
+            return shared;
+
+    std::shared_ptr<FieldGrid> grid(new FieldGrid());
+    if (!grid->file.open(path))
+        throw std::runtime_error("Could not map field grid: " + path);
+    if (grid->file.size() < sizeof(Header))
+        throw std::runtime_error("Field grid too small for a header: " + path);
+
+    Header& h = grid->header;
+    std::memcpy(&h, grid->file.data(), sizeof(Header));
+    if (std::memcmp(h.magic, "EMFG", 4) != 0)
+        throw std::runtime_error("Not an EMFG field grid: " + path);
+    if (h.version != Version)
+        throw std::runtime_error("Unsupported field grid version " + std::to_string(h.version) + ": " + path);
+    if (h.nx < 2 || h.ny < 2 || h.nz < 2 || h.blocks == 0)
+        throw std::runtime_error("Field grid needs 2+ nodes per axis and a block: " + path);
+    if (!(h.spacing[0] > 0 && h.spacing[1] > 0 && h.spacing[2] > 0))
+        throw std::runtime_error("Field grid spacing must be positive: " + path);
+
+    std::uint64_t floats = std::uint64_t(h.nx) * h.ny * h.nz * 3 * h.blocks;
+    if (grid->file.size() < sizeof(Header) + floats * sizeof(float))
+        throw std::runtime_error("Field grid is truncated: " + path);
+
+    grid->data = reinterpret_cast<const float*>(grid->file.data() + sizeof(Header));
+    cache[path] = grid;
+    return grid;
+}
+
+const float* FieldGrid::blockData(int block) const {
+    return data + std::size_t(header.nx) * header.ny * header.nz * 3 * block;
+}
+
+Vec3f FieldGrid::sample(int block, const Vec3f& pos) const {
+    float x = pos.x, y = pos.y, z = pos.z;
+    Vec3f v;
+    sampleScalar(block, &x, &y, &z, 0, 1, 1.0f, &v.x, &v.y, &v.z);
+    return v;
+}
+
+void FieldGrid::sampleMany(PairKernel::Path path, int block, const float* x, const float* y, const float* z,
+                           std::size_t begin, std::size_t end, float scale,
+                           float* outX, float* outY, float* outZ) const {
+    // Gathers index with 32 bit offsets
+    bool fits = std::uint64_t(header.nx) * header.ny * header.nz * 3 < std::uint64_t(INT_MAX);
+
+    if (path != PairKernel::Path::Scalar && fits)
+        sampleAVX2(block, x, y, z, begin, end, scale, outX, outY, outZ);
+    else
+        sampleScalar(block, x, y, z, begin, end, scale, outX, outY, outZ);
+}
+
+void FieldGrid::sampleScalar(int block, const float* x, const float* y, const float* z,
+                             std::size_t begin, std::size_t end, float scale,
+                             float* outX, float* outY, float* outZ) const {
+    const int nx = header.nx, ny = header.ny, nz = header.nz;
+    const float* d = blockData(block);
+
+    for (std::size_t p = begin; p < end; p++) {
+        float u = (x[p] - header.origin[0]) / header.spacing[0];
+        float v = (y[p] - header.origin[1]) / header.spacing[1];
+        float w = (z[p] - header.origin[2]) / header.spacing[2];
+
+        // Written so NaN positions land outside too
+        if (!(u >= 0 && u <= nx - 1 && v >= 0 && v <= ny - 1 && w >= 0 && w <= nz - 1)) {
+            outX[p] = outY[p] = outZ[p] = 0;
+            continue;
+        }
+
+        // The far faces use the last cell with a weight of 1
+        int i = std::min(static_cast<int>(u), nx - 2);
+        int j = std::min(static_cast<int>(v), ny - 2);
+        int k = std::min(static_cast<int>(w), nz - 2);
+        float fx = u - i, fy = v - j, fz = w - k;
+
+        const float* c = d + ((std::size_t(k) * ny + j) * nx + i) * 3;
+        const std::size_t dj = std::size_t(nx) * 3, dk = std::size_t(nx) * ny * 3;
+
+        float out[3];
+        for (int comp = 0; comp < 3; comp++) {
+            float c00 = c[comp] + fx * (c[comp + 3] - c[comp]);
+            float c10 = c[dj + comp] + fx * (c[dj + comp + 3] - c[dj + comp]);
+            float c01 = c[dk + comp] + fx * (c[dk + comp + 3] - c[dk + comp]);
+            float c11 = c[dk + dj + comp] + fx * (c[dk + dj + comp + 3] - c[dk + dj + comp]);
+            float c0 = c00 + fy * (c10 - c00);
+            float c1 = c01 + fy * (c11 - c01);
+            out[comp] = (c0 + fz * (c1 - c0)) * scale;
+        }
+        outX[p] = out[0];
+        outY[p] = out[1];
+        outZ[p] = out[2];
+    }
+}
+
+#if EMSIM_X86
+
+// 8 positions per iteration, each of the 8 cell corners fetched with one gather per component
+EMSIM_TARGET_AVX2
+void FieldGrid::sampleAVX2(int block, const float* x, const float* y, const float* z,
+                           std::size_t begin, std::size_t end, float scale,
+                           float* outX, float* outY, float* outZ) const {
+    const int nx = header.nx, ny = header.ny, nz = header.nz;
+    const float* d = blockData(block);
+
+    const __m256 ox = _mm256_set1_ps(header.origin[0]);
+    const __m256 oy = _mm256_set1_ps(header.origin[1]);
+    const __m256 oz = _mm256_set1_ps(header.origin[2]);
+    const __m256 ix = _mm256_set1_ps(1.0f / header.spacing[0]);
+    const __m256 iy = _mm256_set1_ps(1.0f / header.spacing[1]);
+    const __m256 iz = _mm256_set1_ps(1.0f / header.spacing[2]);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 maxU = _mm256_set1_ps(static_cast<float>(nx - 1));
+    const __m256 maxV = _mm256_set1_ps(static_cast<float>(ny - 1));
+    const __m256 maxW = _mm256_set1_ps(static_cast<float>(nz - 1));
+    const __m256 lastI = _mm256_set1_ps(static_cast<float>(nx - 2));
+    const __m256 lastJ = _mm256_set1_ps(static_cast<float>(ny - 2));
+    const __m256 lastK = _mm256_set1_ps(static_cast<float>(nz - 2));
+    const __m256 scaleV = _mm256_set1_ps(scale);
+
+    // Float offsets of the 8 corners from the base corner
+    const int dj = nx * 3, dk = nx * ny * 3;
+    const int offsets[8] = {0, 3, dj, dj + 3, dk, dk + 3, dk + dj, dk + dj + 3};
+
+    std::size_t p = begin;
+    for (; p + 8 <= end; p += 8) {
+        __m256 u = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(x + p), ox), ix);
+        __m256 v = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(y + p), oy), iy);
+        __m256 w = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(z + p), oz), iz);
+
+        // Ordered compares are false for NaN, so those lanes drop out as well
+        __m256 inside = _mm256_and_ps(
+            _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, maxU, _CMP_LE_OQ)),
+                          _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, maxV, _CMP_LE_OQ))),
+            _mm256_and_ps(_mm256_cmp_ps(w, zero, _CMP_GE_OQ), _mm256_cmp_ps(w, maxW, _CMP_LE_OQ)));
+
+        // Outside lanes are pointed at node 0 so every gather stays inside the mapping
+        u = _mm256_and_ps(u, inside);
+        v = _mm256_and_ps(v, inside);
+        w = _mm256_and_ps(w, inside);
+
+        __m256 fi = _mm256_min_ps(_mm256_floor_ps(u), lastI);
+        __m256 fj = _mm256_min_ps(_mm256_floor_ps(v), lastJ);
+        __m256 fk = _mm256_min_ps(_mm256_floor_ps(w), lastK);
+        __m256 fx = _mm256_sub_ps(u, fi);
+        __m256 fy = _mm256_sub_ps(v, fj);
+        __m256 fz = _mm256_sub_ps(w, fk);
+
+        __m256i cell = _mm256_add_epi32(
+            _mm256_mullo_epi32(_mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(fk), _mm256_set1_epi32(ny)),
+                                                _mm256_cvttps_epi32(fj)), _mm256_set1_epi32(nx)),
+            _mm256_cvttps_epi32(fi));
+        __m256i base = _mm256_mullo_epi32(cell, _mm256_set1_epi32(3));
+
+        __m256 out[3];
+        for (int comp = 0; comp < 3; comp++) {
+            __m256 c[8];
+            for (int corner = 0; corner < 8; corner++)
+                c[corner] = _mm256_i32gather_ps(d + offsets[corner] + comp, base, 4);
+
+            __m256 c00 = _mm256_fmadd_ps(fx, _mm256_sub_ps(c[1], c[0]), c[0]);
+            __m256 c10 = _mm256_fmadd_ps(fx, _mm256_sub_ps(c[3], c[2]), c[2]);
+            __m256 c01 = _mm256_fmadd_ps(fx, _mm256_sub_ps(c[5], c[4]), c[4]);
+            __m256 c11 = _mm256_fmadd_ps(fx, _mm256_sub_ps(c[7], c[6]), c[6]);
+            __m256 c0 = _mm256_fmadd_ps(fy, _mm256_sub_ps(c10, c00), c00);
+            __m256 c1 = _mm256_fmadd_ps(fy, _mm256_sub_ps(c11, c01), c01);
+            out[comp] = _mm256_and_ps(_mm256_mul_ps(_mm256_fmadd_ps(fz, _mm256_sub_ps(c1, c0), c0), scaleV), inside);
+        }
+
+        _mm256_storeu_ps(outX + p, out[0]);
+        _mm256_storeu_ps(outY + p, out[1]);
+        _mm256_storeu_ps(outZ + p, out[2]);
+    }
+
+    sampleScalar(block, x, y, z, p, end, scale, outX, outY, outZ);
+}
+
+#else
+
+void FieldGrid::sampleAVX2(int block, const float* x, const float* y, const float* z,
+                           std::size_t begin, std::size_t end, float scale,
+                           float* outX, float* outY, float* outZ) const {
+    sampleScalar(block, x, y, z, begin, end, scale, outX, outY, outZ);
+}
+
+#endif
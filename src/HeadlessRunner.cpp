@@ -0,0 +1,134 @@
+#include "HeadlessRunner.h"
+#include "Checkpoint.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+HeadlessRunner::HeadlessRunner(Simulation* sim) {
+    this->sim = sim;
+}
+
+int HeadlessRunner::run() {
+    const RunModel& runM = sim->runModel;
+
+    if (runM.steps <= 0 && runM.endTime <= 0) {
+        std::cerr << "Headless run needs a step count or an end time!" << std::endl;
+        return 1;
+    }
+    if (runM.dt <= 0) {
+        std::cerr << "Headless run needs a positive dt!" << std::endl;
+        return 1;
+    }
+
+    // Field grid files are only opened here
+    try {
+        phyeng = PhysicsEngine::create(sim->physicsModel);
+        phyeng->loadSimulation(sim);
+        if (sim->restart)
+            sim->restart->restore(*phyeng);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return 1;
+    }
+
+    double simTime = 0.0;
+    long step = 0;
+    // A restart carries on the clock, so step and time limits count from the original start
+    if (sim->restart) {
+        simTime = sim->restart->time;
+        step = sim->restart->step;
+        sim->restart.reset();
+    }
+    const long firstStep = step;
+
+    // The clock is origin + step * dt rather than a running sum, so rounding cannot pile up into
+    // an extra sliver of a step; origin is 0 unless a restart changed dt
+    const double origin = simTime - step * static_cast<double>(runM.dt);
+    // The end time takes a whole number of steps, a remainder within float rounding of dt is no step of its own
+    long endStep = -1;
+    if (runM.endTime > 0) {
+        double n = (runM.endTime - simTime) / runM.dt;
+        endStep = step + std::max(0L, static_cast<long>(std::ceil(n - n * 2 * FLT_EPSILON)));
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    while (true) {
+        if (runM.steps > 0 && step >= runM.steps) break;
+        if (endStep >= 0 && step >= endStep) break;
+
+        // The last step lands exactly on the end time
+        double dt = runM.dt;
+        if (step + 1 == endStep)
+            dt = runM.endTime - simTime;
+
+        phyeng->integrateForward(simTime, dt);
+        step++;
+        simTime = (step == endStep) ? runM.endTime : origin + step * static_cast<double>(runM.dt);
+
+        if (runM.checkpointEvery > 0 && step % runM.checkpointEvery == 0 && !runM.checkpoint.empty())
+            saveCheckpoint(simTime, step);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Stepped " << phyeng->particleCount() << " particles " << step - firstStep << " times to t = " << simTime
+              << " in " << seconds << " s (" << (seconds > 0 ? (step - firstStep) / seconds : 0.0) << " steps/s)" << std::endl;
+    if (phyeng->integrator == PhysicsEngine::Integrator::DormandPrince)
+        std::cout << "Adaptive steps: " << phyeng->stats.accepted << " accepted, " << phyeng->stats.rejected
+                  << " rejected, last h = " << phyeng->stats.lastStep << std::endl;
+    std::cout << "Force evaluations: " << phyeng->stats.forceEvaluations << std::endl;
+    if (phyeng->collisions)
+        std::cout << "Contacts resolved: " << phyeng->stats.contacts << std::endl;
+
+    if (!writeState(runM.output, simTime)) {
+        std::cerr << "Could not write final state to " << runM.output << std::endl;
+        return 1;
+    }
+    std::cout << "Final state written to " << runM.output << std::endl;
+
+    if (!runM.checkpoint.empty()) {
+        if (!saveCheckpoint(simTime, step))
+            return 1;
+        std::cout << "Checkpoint written to " << runM.checkpoint << std::endl;
+    }
+    return 0;
+}
+
+// A failed write is reported and the run goes on, the previous checkpoint is still in place
+bool HeadlessRunner::saveCheckpoint(double simTime, long step) {
+    try {
+        Checkpoint::write(sim->runModel.checkpoint, *sim, *phyeng, simTime, step);
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool HeadlessRunner::writeState(const std::string& path, double simTime) {
+    std::ofstream out(path);
+    if (!out.is_open())
+        return false;
+
+    const PhysicsEngine& p = *phyeng;
+    // Enough digits to round trip the engine's precision
+    out.precision(p.getPrecision() == PhysicsEngine::Precision::Float ? 9 : 17);
+    out << "# time " << simTime << "\n";
+    out << "name,x,y,z,vx,vy,vz,mass,charge,qw,qx,qy,qz\n";
+    for (std::size_t i = 0; i < p.particleCount(); i++) {
+        Vec3d pos = p.position(i), vel = p.velocity(i);
+        Quaternion q = p.orientation(i);
+        out << sim->objModels[i].name << ','
+            << pos.x << ',' << pos.y << ',' << pos.z << ','
+            << vel.x << ',' << vel.y << ',' << vel.z << ','
+            << p.mass(i) << ',' << p.charge(i) << ','
+            << q.w << ',' << q.x << ',' << q.y << ',' << q.z << '\n';
+    }
+
+    return static_cast<bool>(out);
+}
@@ -1,10 +1,14 @@
 #include "JSONReader.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
 #include <sstream>
 #include <string>
+#include <filesystem>
+
+#include "Expression.h"
 
 Simulation::Simulation(char* filename) {
     std::ifstream JSON(filename);
@@ -15,6 +19,8 @@ Simulation::Simulation(char* filename) {
         return;
     }
 
+    sceneDir = std::filesystem::path(filename).parent_path().string();
+
     std::string line;
 
     // Skip opening {
@@ -84,6 +90,38 @@ Simulation::Simulation(char* filename) {
                     }
                     std::getline(JSON, line);
                 }
+            } else if (memberName.compare("physics") == 0) {
+                std::getline(JSON, line);
+                while (line.find('}') == std::string::npos) {
+                    i = line.find(':');
+                    if (i != std::string::npos) {
+                        try {
+                            memberName = retrieveString(line, 0);
+                            setPhysicsParam(line, memberName, i);
+                        }
+                        catch (const std::exception& e) {
+                            loadedSuccess = false;
+                            throw;
+                        }
+                    }
+                    std::getline(JSON, line);
+                }
+            } else if (memberName.compare("run") == 0) {
+                std::getline(JSON, line);
+                while (line.find('}') == std::string::npos) {
+                    i = line.find(':');
+                    if (i != std::string::npos) {
+                        try {
+                            memberName = retrieveString(line, 0);
+                            setRunParam(line, memberName, i);
+                        }
+                        catch (const std::exception& e) {
+                            loadedSuccess = false;
+                            throw;
+                        }
+                    }
+                    std::getline(JSON, line);
+                }
             } else if (memberName.compare("objects") == 0) {
                 // The closing bracket for the objects array will not be on the same line as an opening bracket
                 while (true) {
@@ -211,6 +249,14 @@ bool Simulation::retrieveBool(std::string line) {
 }
 
 float Simulation::retrieveFloat(std::string line, int pos) {
+    return std::stof(retrieveNumber(line, pos));
+}
+
+double Simulation::retrieveDouble(std::string line, int pos) {
+    return std::stod(retrieveNumber(line, pos));
+}
+
+std::string Simulation::retrieveNumber(std::string line, int pos) {
     std::string::iterator it = line.begin() + pos;
     // Walk until finding first digit
     while (!isdigit(*it) && *it != '-') {
@@ -222,8 +268,7 @@ float Simulation::retrieveFloat(std::string line, int pos) {
         it++;
         pos++;
     }
-    std::string num = line.substr(start, pos-1);
-    return (std::stof(num));
+    return line.substr(start, pos-1);
 }
 
 Vec3f Simulation::retrieveVector(std::string line) {
@@ -243,6 +288,66 @@ Vec3f Simulation::retrieveVector(std::string line) {
     return ret;
 }
 
+Vec3d Simulation::retrieveVector3d(std::string line) {
+    int start = line.find('[');
+    int end = line.find(']');
+    std::string seq = line.substr(start + 1, end - 1);
+
+    std::stringstream ss(seq);
+    Vec3d ret = Vec3d();
+    std::string hold;
+    std::getline(ss, hold, ',');
+    ret.x = std::stod(hold);
+    std::getline(ss, hold, ',');
+    ret.y = std::stod(hold);
+    std::getline(ss, hold, ',');
+    ret.z = std::stod(hold);
+    return ret;
+}
+
+std::vector<std::string> Simulation::retrieveList(std::string line) {
+    std::size_t start = line.find('[');
+    std::size_t end = line.rfind(']');
+    if (start == std::string::npos || end == std::string::npos || end < start)
+        throw 500;
+
+    std::vector<std::string> items;
+    std::string item;
+    bool quoted = false;
+    int depth = 0;
+    for (std::size_t i = start + 1; i < end; i++) {
+        char c = line[i];
+        if (c == '\"') quoted = !quoted;
+        else if (!quoted && c == '(') depth++;
+        else if (!quoted && c == ')') depth--;
+
+        if (c == ',' && !quoted && depth == 0) {
+            items.push_back(item);
+            item.clear();
+        } else if (c != '\"') {
+            item.append(1, c);
+        }
+    }
+    items.push_back(item);
+
+    // Trim the spaces around each item
+    for (std::string& s : items) {
+        std::size_t first = s.find_first_not_of(" \t");
+        std::size_t last = s.find_last_not_of(" \t");
+        s = (first == std::string::npos) ? std::string() : s.substr(first, last - first + 1);
+    }
+    return items;
+}
+
+void Simulation::checkExpression(const std::string& text) {
+    try {
+        Expression check(text);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        throw 500;
+    }
+}
+
 ObjectModel::Color Simulation::retrieveColor(std::string line) {
     int start = line.find('[');
     int end = line.find(']');
@@ -271,6 +376,17 @@ void Simulation::setWindowParam(std::string line, std::string memberName, int po
             this->height = static_cast<int>(retrieveFloat(line, pos));
         else if (memberName.compare("scale") == 0)
             this->scale = retrieveFloat(line, pos);
+        else if (memberName.compare("renderer") == 0) {
+            std::string _renderer = retrieveString(line, pos);
+            if (_renderer.compare("geometry") == 0)
+                this->renderMode = RenderMode::Geometry;
+            else if (_renderer.compare("software") == 0)
+                this->renderMode = RenderMode::Software;
+            else
+                throw 500;
+        }
+        else if (memberName.compare("render_threads") == 0)
+            this->renderThreads = std::max(static_cast<int>(retrieveFloat(line, pos)), 0);
         else
             throw 500;
     } catch (...) {
@@ -320,7 +436,7 @@ void Simulation::setObjectParam(ObjectModel& objM, std::string line, std::string
                 throw 500;
         }
         else if (memberName.compare("center") == 0)
-            objM.center = retrieveVector(line);
+            objM.center = retrieveVector3d(line);
         else if (memberName.compare("radius") == 0)
             objM.radius = retrieveFloat(line, pos);
         else if (memberName.compare("color") == 0)
@@ -328,11 +444,11 @@ void Simulation::setObjectParam(ObjectModel& objM, std::string line, std::string
         else if (memberName.compare("wireframe") == 0)
             objM.wireframe = retrieveBool(line);
         else if (memberName.compare("mass") == 0)
-            objM.mass = retrieveFloat(line, pos);
+            objM.mass = retrieveDouble(line, pos);
         else if (memberName.compare("charge") == 0)
-            objM.charge = retrieveFloat(line, pos);
+            objM.charge = retrieveDouble(line, pos);
         else if (memberName.compare("initial_velocity") == 0)
-            objM.initVelocity = retrieveVector(line);
+            objM.initVelocity = retrieveVector3d(line);
         else if (memberName.compare("initial_acceleration") == 0)
             objM.initAccel = retrieveVector(line);
         else if (memberName.compare("initial_angular_velocity") == 0)
@@ -382,10 +498,160 @@ void Simulation::setFieldParam(FieldModel& fieldM, std::string line, std::string
             else
                 throw 500;
         }
-        else if (memberName.compare("direction") == 0)
-            fieldM.direction = retrieveVector(line);
-        else if (memberName.compare("strength") == 0)
-            fieldM.strength = retrieveFloat(line, pos);
+        else if (memberName.compare("direction") == 0) {
+            // Arrays with any quoted entry become three expressions
+            if (line.find('\"', pos) == std::string::npos) {
+                fieldM.direction = retrieveVector(line);
+            } else {
+                std::vector<std::string> items = retrieveList(line);
+                if (items.size() != 3)
+                    throw 500;
+                for (int c = 0; c < 3; c++) {
+                    checkExpression(items[c]);
+                    fieldM.directionExpr[c] = items[c];
+                }
+            }
+        }
+        else if (memberName.compare("strength") == 0) {
+            if (line.find('\"', pos) == std::string::npos) {
+                fieldM.strength = retrieveFloat(line, pos);
+            } else {
+                fieldM.strengthExpr = retrieveString(line, pos);
+                checkExpression(fieldM.strengthExpr);
+            }
+        }
+        else if (memberName.compare("grid") == 0) {
+            std::filesystem::path gridPath(retrieveString(line, pos));
+            if (gridPath.is_relative())
+                gridPath = std::filesystem::path(sceneDir) / gridPath;
+            fieldM.grid = gridPath.string();
+        }
+        else if (memberName.compare("grid_block") == 0)
+            fieldM.gridBlock = static_cast<int>(retrieveFloat(line, pos));
+        else
+            throw 500;
+    } catch (...) {
+        throw std::runtime_error("Error on: " + line);
+    }
+}
+
+void Simulation::setPhysicsParam(std::string line, std::string memberName, int pos) {
+    try {
+        if (memberName.compare("force_method") == 0) {
+            std::string _method = retrieveString(line, pos);
+            if (_method.compare("all_pairs") == 0)
+                physicsModel.forceMethod = PhysicsModel::ForceMethod::AllPairs;
+            else if (_method.compare("barnes_hut") == 0)
+                physicsModel.forceMethod = PhysicsModel::ForceMethod::BarnesHut;
+            else if (_method.compare("tiled") == 0)
+                physicsModel.forceMethod = PhysicsModel::ForceMethod::Tiled;
+            else if (_method.compare("particle_mesh") == 0)
+                physicsModel.forceMethod = PhysicsModel::ForceMethod::ParticleMesh;
+            else
+                throw 500;
+        }
+        else if (memberName.compare("theta") == 0)
+            physicsModel.theta = retrieveFloat(line, pos);
+        else if (memberName.compare("simd") == 0) {
+            std::string _simd = retrieveString(line, pos);
+            if (_simd.compare("auto") == 0)
+                physicsModel.simd = PhysicsModel::SimdPath::Auto;
+            else if (_simd.compare("scalar") == 0)
+                physicsModel.simd = PhysicsModel::SimdPath::Scalar;
+            else if (_simd.compare("avx2") == 0)
+                physicsModel.simd = PhysicsModel::SimdPath::AVX2;
+            else if (_simd.compare("avx512") == 0)
+                physicsModel.simd = PhysicsModel::SimdPath::AVX512;
+            else
+                throw 500;
+        }
+        else if (memberName.compare("precision") == 0) {
+            std::string _precision = retrieveString(line, pos);
+            if (_precision.compare("float") == 0)
+                physicsModel.precision = PhysicsModel::Precision::Float;
+            else if (_precision.compare("double") == 0)
+                physicsModel.precision = PhysicsModel::Precision::Double;
+            else if (_precision.compare("mixed") == 0)
+                physicsModel.precision = PhysicsModel::Precision::Mixed;
+            else
+                throw 500;
+        }
+        else if (memberName.compare("integrator") == 0) {
+            std::string _integrator = retrieveString(line, pos);
+            if (_integrator.compare("rk4") == 0)
+                physicsModel.integrator = PhysicsModel::Integrator::RK4;
+            else if (_integrator.compare("dopri5") == 0)
+                physicsModel.integrator = PhysicsModel::Integrator::DormandPrince;
+            else if (_integrator.compare("boris") == 0)
+                physicsModel.integrator = PhysicsModel::Integrator::Boris;
+            else if (_integrator.compare("block") == 0)
+                physicsModel.integrator = PhysicsModel::Integrator::BlockStep;
+            else
+                throw 500;
+        }
+        else if (memberName.compare("abs_tol") == 0)
+            physicsModel.absTol = retrieveFloat(line, pos);
+        else if (memberName.compare("rel_tol") == 0)
+            physicsModel.relTol = retrieveFloat(line, pos);
+        else if (memberName.compare("max_level") == 0)
+            physicsModel.maxLevel = static_cast<int>(retrieveFloat(line, pos));
+        else if (memberName.compare("eta") == 0)
+            physicsModel.eta = retrieveFloat(line, pos);
+        else if (memberName.compare("pm_grid") == 0)
+            physicsModel.pmGrid = static_cast<int>(retrieveFloat(line, pos));
+        else if (memberName.compare("pm_boundary") == 0) {
+            std::string _boundary = retrieveString(line, pos);
+            if (_boundary.compare("isolated") == 0)
+                physicsModel.pmBoundary = PhysicsModel::PmBoundary::Isolated;
+            else if (_boundary.compare("periodic") == 0)
+                physicsModel.pmBoundary = PhysicsModel::PmBoundary::Periodic;
+            else
+                throw 500;
+        }
+        else if (memberName.compare("pm_box") == 0)
+            physicsModel.pmBox = retrieveFloat(line, pos);
+        else if (memberName.compare("p3m") == 0)
+            physicsModel.p3m = retrieveBool(line);
+        else if (memberName.compare("p3m_split") == 0)
+            physicsModel.p3mSplit = retrieveFloat(line, pos);
+        else if (memberName.compare("collisions") == 0)
+            physicsModel.collisions = retrieveBool(line);
+        else if (memberName.compare("restitution") == 0)
+            physicsModel.restitution = retrieveFloat(line, pos);
+        else if (memberName.compare("threads") == 0)
+            physicsModel.threads = static_cast<int>(retrieveFloat(line, pos));
+        else
+            throw 500;
+    } catch (...) {
+        throw std::runtime_error("Error on: " + line);
+    }
+}
+
+void Simulation::setRunParam(std::string line, std::string memberName, int pos) {
+    try {
+        if (memberName.compare("mode") == 0) {
+            std::string _mode = retrieveString(line, pos);
+            if (_mode.compare("headless") == 0)
+                runModel.headless = true;
+            else if (_mode.compare("window") == 0)
+                runModel.headless = false;
+            else
+                throw 500;
+        }
+        else if (memberName.compare("steps") == 0)
+            runModel.steps = static_cast<int>(retrieveFloat(line, pos));
+        else if (memberName.compare("end_time") == 0)
+            runModel.endTime = retrieveFloat(line, pos);
+        else if (memberName.compare("dt") == 0)
+            runModel.dt = retrieveFloat(line, pos);
+        else if (memberName.compare("interpolate") == 0)
+            runModel.interpolate = retrieveBool(line);
+        else if (memberName.compare("output") == 0)
+            runModel.output.assign(retrieveString(line, pos));
+        else if (memberName.compare("checkpoint") == 0)
+            runModel.checkpoint.assign(retrieveString(line, pos));
+        else if (memberName.compare("checkpoint_every") == 0)
+            runModel.checkpointEvery = static_cast<int>(retrieveFloat(line, pos));
         else
             throw 500;
     } catch (...) {
@@ -0,0 +1,212 @@
+#include "MeshLibrary.h"
+
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+
+std::shared_ptr<const Mesh> MeshLibrary::get(Shape shape, int level) {
+    static std::map<std::pair<Shape, int>, std::shared_ptr<const Mesh>> meshes;
+
+    // Only spheres come in levels
+    if (shape != Shape::Sphere)
+        level = 0;
+    level = std::min(std::max(level, 0), MaxLevel);
+
+    auto key = std::make_pair(shape, level);
+    auto found = meshes.find(key);
+    if (found != meshes.end())
+        return found->second;
+
+    Mesh mesh;
+    switch (shape)
+    {
+        case Shape::Tetrahedron:
+            mesh = tetrahedron();
+            break;
+        case Shape::Icosahedron:
+            mesh = icosahedron();
+            break;
+        case Shape::Sphere:
+            // Each level refines the one below it, which is cached along the way
+            mesh = (level == 0) ? icosahedron() : subdivide(*get(Shape::Sphere, level - 1));
+            break;
+        case Shape::Cube:
+            mesh = cube();
+            break;
+    }
+
+    finish(mesh);
+    std::shared_ptr<const Mesh> shared = std::make_shared<const Mesh>(std::move(mesh));
+    meshes[key] = shared;
+    return shared;
+}
+
+Mesh MeshLibrary::tetrahedron() {
+    Mesh m;
+
+    // Computed value for regular tetrahedron
+    float ang = 0.33981f;
+    float b = std::sin(ang);
+    float c = std::cos(ang);
+
+    m.vertices.push_back(Vec3f(0, 0, 1));
+    m.vertices.push_back(Vec3f(c, 0, -b));
+    m.vertices.push_back(Vec3f(-c, 0, -b));
+    m.vertices.push_back(Vec3f(0, c, -b));
+
+    m.tris.push_back(Triangle(0, 1, 2));
+    m.tris.push_back(Triangle(0, 1, 3));
+    m.tris.push_back(Triangle(0, 2, 3));
+    m.tris.push_back(Triangle(1, 2, 3));
+    return m;
+}
+
+Mesh MeshLibrary::icosahedron() {
+    Mesh m;
+
+    const float ang = static_cast<float>(1 / std::sqrt(5));
+
+    float x = std::cos(std::asin(ang));
+    float y = ang;
+
+    Vec3f startPoint(x, y, 0);
+
+    m.vertices.push_back(startPoint);
+    m.vertices.push_back(startPoint.cycle());
+    m.vertices.push_back(startPoint.cycle().cycle());
+    m.vertices.push_back(startPoint.negate(false, true, false));
+    m.vertices.push_back(startPoint.cycle().negate(false, true, false));
+    m.vertices.push_back(startPoint.cycle().negate(false, true, true));
+    m.vertices.push_back(startPoint.cycle().cycle().negate(true, false, false));
+    m.vertices.push_back(startPoint.cycle().negate(false, false, true));
+    m.vertices.push_back(startPoint.negate(true, false, false));
+    m.vertices.push_back(startPoint.negate(true, true, false));
+    m.vertices.push_back(startPoint.cycle().cycle().negate(false, false, true));
+    m.vertices.push_back(startPoint.cycle().cycle().negate(true, false, true));
+
+    m.tris.push_back(Triangle(0, 1, 2));
+    m.tris.push_back(Triangle(0, 3, 2));
+    m.tris.push_back(Triangle(3, 4, 2));
+    m.tris.push_back(Triangle(3, 5, 4));
+    m.tris.push_back(Triangle(4, 6, 2));
+    m.tris.push_back(Triangle(6, 1, 2));
+    m.tris.push_back(Triangle(0, 1, 7));
+    m.tris.push_back(Triangle(1, 8, 6));
+    m.tris.push_back(Triangle(6, 8, 9));
+    m.tris.push_back(Triangle(9, 4, 6));
+    m.tris.push_back(Triangle(4, 9, 5));
+    m.tris.push_back(Triangle(7, 8, 1));
+    m.tris.push_back(Triangle(10, 0, 3));
+    m.tris.push_back(Triangle(10, 5, 3));
+    m.tris.push_back(Triangle(10, 7, 0));
+    m.tris.push_back(Triangle(11, 5, 10));
+    m.tris.push_back(Triangle(11, 5, 9));
+    m.tris.push_back(Triangle(11, 9, 8));
+    m.tris.push_back(Triangle(11, 8, 7));
+    m.tris.push_back(Triangle(11, 7, 10));
+    return m;
+}
+
+Mesh MeshLibrary::cube() {
+    Mesh m;
+
+    // Top Face
+    m.vertices.push_back(Vec3f(1, 1, 1)); // TFR
+    m.vertices.push_back(Vec3f(-1, 1, 1)); // TFL
+    m.vertices.push_back(Vec3f(-1, 1, -1)); // TBL
+    m.vertices.push_back(Vec3f(1, 1, -1)); // TBR
+
+    // Bottom Face
+    m.vertices.push_back(Vec3f(1, -1, 1)); // BFR
+    m.vertices.push_back(Vec3f(-1, -1, 1)); // BFL
+    m.vertices.push_back(Vec3f(-1, -1, -1)); // BBL
+    m.vertices.push_back(Vec3f(1, -1, -1)); // BBR
+
+    // Top Face
+    m.tris.push_back(Triangle(0, 1, 2));
+    m.tris.push_back(Triangle(2, 3, 0));
+
+    m.tris.push_back(Triangle(4, 0, 1));
+    m.tris.push_back(Triangle(4, 0, 3));
+
+    m.tris.push_back(Triangle(5, 4, 1));
+    m.tris.push_back(Triangle(5, 1, 2));
+
+    m.tris.push_back(Triangle(6, 5, 2));
+    m.tris.push_back(Triangle(6, 2, 3));
+
+    m.tris.push_back(Triangle(7, 6, 3));
+    m.tris.push_back(Triangle(7, 4, 3));
+
+    // Bottom Face
+    m.tris.push_back(Triangle(4, 5, 6));
+    m.tris.push_back(Triangle(6, 7, 4));
+    return m;
+}
+
+struct PairHash {
+    std::size_t operator()(const std::pair<int, int>& p) const {
+        return std::hash<int>()(p.first) ^ (std::hash<int>()(p.second) << 1);
+    }
+};
+
+Mesh MeshLibrary::subdivide(const Mesh& mesh) {
+    Mesh m;
+    m.vertices = mesh.vertices;
+    m.tris.reserve(mesh.tris.size() * 4);
+
+    // Edges shared by two triangles get one midpoint
+    std::unordered_map<std::pair<int, int>, int, PairHash> midPointIndex;
+    midPointIndex.reserve(mesh.tris.size() * 3 / 2);
+    auto getMidpoint = [&](int i1, int i2) {
+        std::pair<int, int> key = std::minmax(i1, i2);
+        auto it = midPointIndex.find(key);
+        if (it != midPointIndex.end())
+            return it->second;
+
+        Vec3f mid = (m.vertices[i1] + m.vertices[i2]) * 0.5f;
+        int newIndex = static_cast<int>(m.vertices.size());
+        m.vertices.push_back(mid.normalize());
+        midPointIndex[key] = newIndex;
+        return newIndex;
+    };
+
+    for (const Triangle& tri : mesh.tris) {
+        int m01 = getMidpoint(tri.a, tri.b);
+        int m12 = getMidpoint(tri.b, tri.c);
+        int m20 = getMidpoint(tri.c, tri.a);
+
+        m.tris.push_back(Triangle(tri.a, m01, m20));
+        m.tris.push_back(Triangle(tri.b, m12, m01));
+        m.tris.push_back(Triangle(tri.c, m20, m12));
+        m.tris.push_back(Triangle(m01, m12, m20));
+    }
+    return m;
+}
+
+void MeshLibrary::finish(Mesh& mesh) {
+    mesh.normals.assign(mesh.vertices.size(), Vec3f());
+    for (Triangle& tri : mesh.tris) {
+        Vec3f A = mesh.vertices[tri.a];
+        Vec3f v = mesh.vertices[tri.c] - A;
+        Vec3f Norm = (mesh.vertices[tri.b] - A).cross(v).normalize();
+
+        Vec3f centroid = (A + mesh.vertices[tri.b] + mesh.vertices[tri.c]) * (1.0f / 3.0f);
+        if (Norm.dot(centroid) < 0) {
+            std::swap(tri.b, tri.c);
+            Norm = Norm * -1.0f;
+        }
+
+        for (int idx : {tri.a, tri.b, tri.c})
+            mesh.normals[idx] = mesh.normals[idx] + Norm;
+    }
+
+    for (Vec3f& n : mesh.normals)
+        n = n.normalize();
+
+    mesh.radius = 0;
+    for (Vec3f p : mesh.vertices)
+        mesh.radius = std::max(mesh.radius, std::sqrt(p.dot(p)));
+}
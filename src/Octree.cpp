@@ -0,0 +1,173 @@
+#include "Octree.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Bodies per leaf before a cell is split
+static const int LeafSize = 8;
+// Coincident bodies would otherwise split forever
+static const int MaxDepth = 24;
+
+void Octree::build(const float* x, const float* y, const float* z, const float* charges, const float* masses, int n) {
+    this->x = x;
+    this->y = y;
+    this->z = z;
+    this->charges = charges;
+    this->masses = masses;
+
+    int N = n;
+    nodes.clear();
+    order.resize(N);
+    scratch.resize(N);
+    if (N == 0) return;
+
+    for (int i = 0; i < N; i++)
+        order[i] = i;
+
+    // Bounding cube of every body
+    Vec3f lo(x[0], y[0], z[0]), hi = lo;
+    for (int i = 1; i < N; i++) {
+        lo = Vec3f(std::min(lo.x, x[i]), std::min(lo.y, y[i]), std::min(lo.z, z[i]));
+        hi = Vec3f(std::max(hi.x, x[i]), std::max(hi.y, y[i]), std::max(hi.z, z[i]));
+    }
+    float extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+
+    Node root;
+    root.center = (lo + hi) * 0.5f;
+    root.halfSize = extent * 0.5f * 1.001f + 1e-6f;
+    root.firstChild = -1;
+    root.begin = 0;
+    root.end = N;
+    nodes.reserve(2 * N);
+    nodes.push_back(root);
+
+    buildNode(0, 0);
+}
+
+// Split a node into octants, recursing until leaves are small enough
+void Octree::buildNode(int nodeIdx, int depth) {
+    // nodes may reallocate while children are added, so only hold copies
+    Node node = nodes[nodeIdx];
+    int count = node.end - node.begin;
+
+    if (count <= LeafSize || depth >= MaxDepth) {
+        computeMoments(nodes[nodeIdx]);
+        return;
+    }
+
+    // Counting sort of the node's bodies by octant
+    int counts[8] = {};
+    for (int k = node.begin; k < node.end; k++) {
+        int j = order[k];
+        int oct = (x[j] >= node.center.x) | ((y[j] >= node.center.y) << 1) | ((z[j] >= node.center.z) << 2);
+        counts[oct]++;
+    }
+
+    int starts[8];
+    starts[0] = node.begin;
+    for (int o = 1; o < 8; o++)
+        starts[o] = starts[o - 1] + counts[o - 1];
+
+    int fill[8];
+    std::copy(starts, starts + 8, fill);
+    for (int k = node.begin; k < node.end; k++) {
+        int j = order[k];
+        int oct = (x[j] >= node.center.x) | ((y[j] >= node.center.y) << 1) | ((z[j] >= node.center.z) << 2);
+        scratch[fill[oct]++] = order[k];
+    }
+    std::copy(scratch.begin() + node.begin, scratch.begin() + node.end, order.begin() + node.begin);
+
+    int firstChild = static_cast<int>(nodes.size());
+    float quarter = node.halfSize * 0.5f;
+    for (int o = 0; o < 8; o++) {
+        Node child;
+        child.center = node.center + Vec3f((o & 1) ? quarter : -quarter,
+                                           (o & 2) ? quarter : -quarter,
+                                           (o & 4) ? quarter : -quarter);
+        child.halfSize = quarter;
+        child.firstChild = -1;
+        child.begin = starts[o];
+        child.end = starts[o] + counts[o];
+        nodes.push_back(child);
+    }
+    nodes[nodeIdx].firstChild = firstChild;
+
+    for (int o = 0; o < 8; o++)
+        if (counts[o] > 0)
+            buildNode(firstChild + o, depth + 1);
+
+    computeMoments(nodes[nodeIdx]);
+}
+
+// Total charge, total mass and their centers over the node's bodies
+void Octree::computeMoments(Node& node) {
+    float Q = 0, absQ = 0, M = 0;
+    Vec3f qSum, mSum;
+    for (int k = node.begin; k < node.end; k++) {
+        int j = order[k];
+        Vec3f p(x[j], y[j], z[j]);
+        float q = charges[j];
+        float m = masses[j];
+        Q += q;
+        absQ += std::fabs(q);
+        M += m;
+        qSum = qSum + p * std::fabs(q);
+        mSum = mSum + p * m;
+    }
+
+    node.totalCharge = Q;
+    node.totalMass = M;
+    node.chargeCenter = (absQ > 0) ? qSum * (1.f / absQ) : node.center;
+    node.massCenter = (M > 0) ? mSum * (1.f / M) : node.center;
+}
+
+Vec3f Octree::computeForce(int i, const Vec3f& pos, float kq, float gm, float theta) const {
+    Vec3f force;
+    if (nodes.empty()) return force;
+
+    const float theta2 = theta * theta;
+    int stack[8 * MaxDepth + 8];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        if (node.begin == node.end) continue;
+
+        if (node.firstChild < 0) {
+            // Leaf: sum its bodies directly
+            for (int k = node.begin; k < node.end; k++) {
+                int j = order[k];
+                if (j == i) continue;
+                Vec3f r = pos - Vec3f(x[j], y[j], z[j]);
+                float d2 = r.x * r.x + r.y * r.y + r.z * r.z;
+                if (d2 == 0) continue;
+                float scale = (kq * charges[j] - gm * masses[j]) / (d2 * std::sqrt(d2));
+                force = force + r * scale;
+            }
+            continue;
+        }
+
+        // Never approximate a cell that contains the target
+        bool inside = std::fabs(pos.x - node.center.x) <= node.halfSize &&
+                      std::fabs(pos.y - node.center.y) <= node.halfSize &&
+                      std::fabs(pos.z - node.center.z) <= node.halfSize;
+
+        float size = 2 * node.halfSize;
+        Vec3f rq = pos - node.chargeCenter;
+        Vec3f rm = pos - node.massCenter;
+        float dq2 = rq.x * rq.x + rq.y * rq.y + rq.z * rq.z;
+        float dm2 = rm.x * rm.x + rm.y * rm.y + rm.z * rm.z;
+
+        if (!inside && size * size < theta2 * dq2 && size * size < theta2 * dm2) {
+            // Far enough away: use the monopoles
+            force = force + rq * (kq * node.totalCharge / (dq2 * std::sqrt(dq2)));
+            force = force - rm * (gm * node.totalMass / (dm2 * std::sqrt(dm2)));
+        } else {
+            for (int o = 0; o < 8; o++)
+                stack[top++] = node.firstChild + o;
+        }
+    }
+
+    return force;
+}
@@ -0,0 +1,190 @@
+#include "PairKernel.h"
+
+#include <cmath>
+
+#include "Simd.h"
+
+PairKernel::Path PairKernel::detect() {
+#if EMSIM_X86 && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    if (maxLeaf < 7) return Path::Scalar;
+
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    if (!osxsave) return Path::Scalar;
+
+    // The OS has to save the YMM (and ZMM) registers on context switches
+    unsigned long long xcr0 = _xgetbv(0);
+    bool ymm = (xcr0 & 0x6) == 0x6;
+    bool zmm = (xcr0 & 0xE6) == 0xE6;
+
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    bool avx512f = (info[1] & (1 << 16)) != 0;
+
+    if (avx512f && zmm) return Path::AVX512;
+    if (avx2 && fma && ymm) return Path::AVX2;
+    return Path::Scalar;
+#elif EMSIM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return Path::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return Path::AVX2;
+    return Path::Scalar;
+#else
+    return Path::Scalar;
+#endif
+}
+
+const char* PairKernel::name(Path path) {
+    switch (path)
+    {
+        case Path::AVX2: return "avx2";
+        case Path::AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+Vec3f PairKernel::sum(Path path, const float* x, const float* y, const float* z, const float* q, const float* m,
+                      std::size_t begin, std::size_t end, const Vec3f& pos, float kq, float gm) {
+    switch (path)
+    {
+        case Path::AVX512: return sumAVX512(x, y, z, q, m, begin, end, pos, kq, gm);
+        case Path::AVX2: return sumAVX2(x, y, z, q, m, begin, end, pos, kq, gm);
+        default: return sumScalar(x, y, z, q, m, begin, end, pos, kq, gm);
+    }
+}
+
+// Fused scalar loop, also used for the tails of the vector paths
+Vec3f PairKernel::sumScalar(const float* x, const float* y, const float* z, const float* q, const float* m,
+                            std::size_t begin, std::size_t end, const Vec3f& pos, float kq, float gm) {
+    float fx = 0, fy = 0, fz = 0;
+    for (std::size_t j = begin; j < end; j++) {
+        float dx = pos.x - x[j];
+        float dy = pos.y - y[j];
+        float dz = pos.z - z[j];
+        float r2 = dx * dx + dy * dy + dz * dz;
+        if (r2 == 0) continue;
+        float rinv = 1.f / std::sqrt(r2);
+        float s = (kq * q[j] - gm * m[j]) * rinv * rinv * rinv;
+        fx += dx * s;
+        fy += dy * s;
+        fz += dz * s;
+    }
+    return Vec3f(fx, fy, fz);
+}
+
+#if EMSIM_X86
+
+// 8 emitters per iteration
+EMSIM_TARGET_AVX2
+Vec3f PairKernel::sumAVX2(const float* x, const float* y, const float* z, const float* q, const float* m,
+                          std::size_t begin, std::size_t end, const Vec3f& pos, float kq, float gm) {
+    const __m256 px = _mm256_set1_ps(pos.x);
+    const __m256 py = _mm256_set1_ps(pos.y);
+    const __m256 pz = _mm256_set1_ps(pos.z);
+    const __m256 kqv = _mm256_set1_ps(kq);
+    const __m256 gmv = _mm256_set1_ps(gm);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+
+    __m256 fx = zero, fy = zero, fz = zero;
+
+    std::size_t j = begin;
+    for (; j + 8 <= end; j += 8) {
+        __m256 dx = _mm256_sub_ps(px, _mm256_loadu_ps(x + j));
+        __m256 dy = _mm256_sub_ps(py, _mm256_loadu_ps(y + j));
+        __m256 dz = _mm256_sub_ps(pz, _mm256_loadu_ps(z + j));
+
+        __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+        __m256 valid = _mm256_cmp_ps(r2, zero, _CMP_NEQ_OQ);
+
+        // rsqrt estimate refined by one Newton step
+        __m256 rinv = _mm256_rsqrt_ps(r2);
+        rinv = _mm256_mul_ps(rinv, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(rinv, rinv), threeHalves));
+        __m256 rinv3 = _mm256_mul_ps(rinv, _mm256_mul_ps(rinv, rinv));
+
+        __m256 scale = _mm256_fmsub_ps(kqv, _mm256_loadu_ps(q + j), _mm256_mul_ps(gmv, _mm256_loadu_ps(m + j)));
+        scale = _mm256_and_ps(_mm256_mul_ps(scale, rinv3), valid);
+
+        fx = _mm256_fmadd_ps(dx, scale, fx);
+        fy = _mm256_fmadd_ps(dy, scale, fy);
+        fz = _mm256_fmadd_ps(dz, scale, fz);
+    }
+
+    float lanes[3][8];
+    _mm256_storeu_ps(lanes[0], fx);
+    _mm256_storeu_ps(lanes[1], fy);
+    _mm256_storeu_ps(lanes[2], fz);
+    Vec3f force = sumScalar(x, y, z, q, m, j, end, pos, kq, gm);
+    for (int l = 0; l < 8; l++)
+        force = force + Vec3f(lanes[0][l], lanes[1][l], lanes[2][l]);
+    return force;
+}
+
+// 16 emitters per iteration
+// GCC 12 flags the undefined vectors inside _mm512_rsqrt14_ps and _mm512_reduce_add_ps as uninitialized
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wuninitialized"
+    #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+EMSIM_TARGET_AVX512
+Vec3f PairKernel::sumAVX512(const float* x, const float* y, const float* z, const float* q, const float* m,
+                            std::size_t begin, std::size_t end, const Vec3f& pos, float kq, float gm) {
+    const __m512 px = _mm512_set1_ps(pos.x);
+    const __m512 py = _mm512_set1_ps(pos.y);
+    const __m512 pz = _mm512_set1_ps(pos.z);
+    const __m512 kqv = _mm512_set1_ps(kq);
+    const __m512 gmv = _mm512_set1_ps(gm);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+
+    __m512 fx = zero, fy = zero, fz = zero;
+
+    std::size_t j = begin;
+    for (; j + 16 <= end; j += 16) {
+        __m512 dx = _mm512_sub_ps(px, _mm512_loadu_ps(x + j));
+        __m512 dy = _mm512_sub_ps(py, _mm512_loadu_ps(y + j));
+        __m512 dz = _mm512_sub_ps(pz, _mm512_loadu_ps(z + j));
+
+        __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+        __mmask16 valid = _mm512_cmp_ps_mask(r2, zero, _CMP_NEQ_OQ);
+
+        // 14 bit estimate refined by one Newton step
+        __m512 rinv = _mm512_rsqrt14_ps(r2);
+        rinv = _mm512_mul_ps(rinv, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(rinv, rinv), threeHalves));
+        __m512 rinv3 = _mm512_mul_ps(rinv, _mm512_mul_ps(rinv, rinv));
+
+        __m512 scale = _mm512_fmsub_ps(kqv, _mm512_loadu_ps(q + j), _mm512_mul_ps(gmv, _mm512_loadu_ps(m + j)));
+        scale = _mm512_maskz_mul_ps(valid, scale, rinv3);
+
+        fx = _mm512_fmadd_ps(dx, scale, fx);
+        fy = _mm512_fmadd_ps(dy, scale, fy);
+        fz = _mm512_fmadd_ps(dz, scale, fz);
+    }
+
+    Vec3f force = sumScalar(x, y, z, q, m, j, end, pos, kq, gm);
+    return force + Vec3f(_mm512_reduce_add_ps(fx), _mm512_reduce_add_ps(fy), _mm512_reduce_add_ps(fz));
+}
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic pop
+#endif
+
+#else
+
+Vec3f PairKernel::sumAVX2(const float* x, const float* y, const float* z, const float* q, const float* m,
+                          std::size_t begin, std::size_t end, const Vec3f& pos, float kq, float gm) {
+    return sumScalar(x, y, z, q, m, begin, end, pos, kq, gm);
+}
+
+Vec3f PairKernel::sumAVX512(const float* x, const float* y, const float* z, const float* q, const float* m,
+                            std::size_t begin, std::size_t end, const Vec3f& pos, float kq, float gm) {
+    return sumScalar(x, y, z, q, m, begin, end, pos, kq, gm);
+}
+
+#endif
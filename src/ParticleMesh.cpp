@@ -0,0 +1,417 @@
+#include "ParticleMesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Short range pairs are summed out to this many split radii, erfc(2.5) is below 1e-3
+static const float CutoffSplits = 5.0f;
+// Upper bound on short range cells per axis
+static const int MaxCells = 64;
+
+void ParticleMesh::configure(int gridSize, Boundary boundary, float box, float splitCells) {
+    int size = 8;
+    while (size < gridSize)
+        size <<= 1;
+
+    this->gridSize = size;
+    this->boundary = boundary;
+    this->box = box;
+    this->splitCells = std::max(splitCells, 0.0f);
+
+    M = (boundary == Boundary::Isolated) ? 2 * size : size;
+    h = 0;
+    greenH = 0;
+    twiddles.clear();
+}
+
+void ParticleMesh::solve(const float* x, const float* y, const float* z, const float* charges, const float* masses,
+                         int n, ThreadPool& pool) {
+    this->x = x;
+    this->y = y;
+    this->z = z;
+    this->charges = charges;
+    this->masses = masses;
+
+    const int N = gridSize;
+    if (M == 0)
+        configure(gridSize, boundary, box, splitCells);
+    if (twiddles.empty())
+        prepareTables();
+
+    fitBox(x, y, z, n);
+    prepareGreen(pool);
+
+    chargeScale = 0;
+    massScale = 0;
+    for (int p = 0; p < n; p++) {
+        chargeScale = std::max(chargeScale, std::abs(charges[p]));
+        massScale = std::max(massScale, std::abs(masses[p]));
+    }
+    if (chargeScale == 0) chargeScale = 1;
+    if (massScale == 0) massScale = 1;
+    const float qNorm = 1.0f / chargeScale, mNorm = 1.0f / massScale;
+
+    // Cloud-in-cell deposit, serial so the grid sums are reproducible
+    grid.assign(static_cast<std::size_t>(M) * M * M, Cell(0, 0));
+    for (int p = 0; p < n; p++) {
+        int b[3];
+        float f[3];
+        cicWeights(Vec3f(x[p], y[p], z[p]), b, f);
+
+        for (int c = 0; c < 8; c++) {
+            int ix = wrap(b[0] + (c & 1), M), iy = wrap(b[1] + ((c >> 1) & 1), M), iz = wrap(b[2] + ((c >> 2) & 1), M);
+            float w = ((c & 1) ? f[0] : 1 - f[0]) * ((c & 2) ? f[1] : 1 - f[1]) * ((c & 4) ? f[2] : 1 - f[2]);
+            grid[(static_cast<std::size_t>(ix) * M + iy) * M + iz] += Cell(w * charges[p] * qNorm, w * masses[p] * mNorm);
+        }
+    }
+
+    // Convolve with the Green's function: isolated tables are in cell units and scale as 1 / h
+    fft3(grid, false, boundary == Boundary::Isolated, pool);
+    const float greenScale = (boundary == Boundary::Isolated) ? 1.0f / h : 1.0f;
+    pool.parallelFor(grid.size(), [&](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t i = begin; i < end; i++)
+            grid[i] *= green[i] * greenScale;
+    });
+    fft3(grid, true, false, pool);
+
+    // Centred differences on the physical nodes; the isolated potential is valid one node past them
+    const std::size_t nodes = static_cast<std::size_t>(N) * N * N;
+    ex.resize(nodes); ey.resize(nodes); ez.resize(nodes);
+    const float inv2h = -0.5f / h;
+    pool.parallelFor(static_cast<std::size_t>(N) * N, [&](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t line = begin; line < end; line++) {
+            int i = static_cast<int>(line / N), j = static_cast<int>(line % N);
+            for (int k = 0; k < N; k++) {
+                auto at = [&](int a, int b, int c) {
+                    return grid[(static_cast<std::size_t>(wrap(a, M)) * M + wrap(b, M)) * M + wrap(c, M)];
+                };
+                std::size_t idx = line * N + k;
+                ex[idx] = (at(i + 1, j, k) - at(i - 1, j, k)) * inv2h;
+                ey[idx] = (at(i, j + 1, k) - at(i, j - 1, k)) * inv2h;
+                ez[idx] = (at(i, j, k + 1) - at(i, j, k - 1)) * inv2h;
+            }
+        }
+    });
+
+    if (splitCells > 0)
+        buildCells(n);
+}
+
+Vec3f ParticleMesh::computeForce(int i, const Vec3f& pos, float kq, float gm) const {
+    const int N = gridSize;
+    int b[3];
+    float f[3];
+    cicWeights(pos, b, f);
+
+    // Interpolate with the deposit weights so the mesh force conserves momentum
+    Cell fx(0, 0), fy(0, 0), fz(0, 0);
+    for (int c = 0; c < 8; c++) {
+        int ix = wrap(b[0] + (c & 1), N), iy = wrap(b[1] + ((c >> 1) & 1), N), iz = wrap(b[2] + ((c >> 2) & 1), N);
+        float w = ((c & 1) ? f[0] : 1 - f[0]) * ((c & 2) ? f[1] : 1 - f[1]) * ((c & 4) ? f[2] : 1 - f[2]);
+        std::size_t idx = (static_cast<std::size_t>(ix) * N + iy) * N + iz;
+        fx += ex[idx] * w;
+        fy += ey[idx] * w;
+        fz += ez[idx] * w;
+    }
+
+    const float kqs = kq * chargeScale, gms = gm * massScale;
+    Vec3f force(kqs * fx.real() - gms * fx.imag(), kqs * fy.real() - gms * fy.imag(), kqs * fz.real() - gms * fz.imag());
+    if (splitCells > 0)
+        force = force + shortRange(i, pos, kq, gm);
+    return force;
+}
+
+// Isolated boxes follow the particles every solve, periodic boxes are fixed on the first one
+void ParticleMesh::fitBox(const float* x, const float* y, const float* z, int n) {
+    const int N = gridSize;
+    if (boundary == Boundary::Periodic && h > 0)
+        return;
+
+    Vec3f lo, hi;
+    if (n > 0) {
+        lo = Vec3f(x[0], y[0], z[0]);
+        hi = lo;
+    }
+    for (int i = 1; i < n; i++) {
+        lo = Vec3f(std::min(lo.x, x[i]), std::min(lo.y, y[i]), std::min(lo.z, z[i]));
+        hi = Vec3f(std::max(hi.x, x[i]), std::max(hi.y, y[i]), std::max(hi.z, z[i]));
+    }
+    Vec3f center = (lo + hi) * 0.5f;
+    float extent = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+    extent = (extent > 0) ? extent * 1.001f : 1.0f;
+
+    if (boundary == Boundary::Isolated) {
+        // Keep every body half a cell inside so its CIC cloud stays on the physical nodes
+        h = extent / (N - 2);
+        origin = center - Vec3f(1, 1, 1) * ((N - 1) * h * 0.5f);
+    } else {
+        // Without a given box, leave room for the cloud to spread before it wraps
+        float L = (box > 0) ? box : extent * 1.5f;
+        h = L / N;
+        origin = (box > 0) ? Vec3f(1, 1, 1) * (-0.5f * L) : center - Vec3f(1, 1, 1) * (0.5f * L);
+    }
+}
+
+void ParticleMesh::cicWeights(const Vec3f& pos, int* base, float* frac) const {
+    const int N = gridSize;
+    float u[3] = {(pos.x - origin.x) / h, (pos.y - origin.y) / h, (pos.z - origin.z) / h};
+
+    for (int a = 0; a < 3; a++) {
+        float v = u[a];
+        if (boundary == Boundary::Periodic)
+            v -= N * std::floor(v / N);
+        else
+            v = std::min(std::max(v, 0.0f), N - 1.001f);
+
+        float b = std::floor(v);
+        base[a] = static_cast<int>(b);
+        frac[a] = v - b;
+    }
+}
+
+/*******************************************************************
+                        GREEN'S FUNCTION
+********************************************************************/
+
+void ParticleMesh::prepareGreen(ThreadPool& pool) {
+    // Isolated tables are built once in cell units, periodic ones for the fixed cell size
+    const float wanted = (boundary == Boundary::Isolated) ? 1.0f : h;
+    if (greenH == wanted && !green.empty())
+        return;
+    greenH = wanted;
+
+    const std::size_t total = static_cast<std::size_t>(M) * M * M;
+    green.resize(total);
+    const float s = splitCells;
+
+    if (boundary == Boundary::Isolated) {
+        // 1 / r on the doubled grid (distances wrap), or its long range erf part under P3M
+        grid.assign(total, Cell(0, 0));
+        pool.parallelFor(total, [&](std::size_t begin, std::size_t end, unsigned) {
+            for (std::size_t idx = begin; idx < end; idx++) {
+                int i = static_cast<int>(idx / (static_cast<std::size_t>(M) * M));
+                int j = static_cast<int>((idx / M) % M);
+                int k = static_cast<int>(idx % M);
+                float di = static_cast<float>(std::min(i, M - i));
+                float dj = static_cast<float>(std::min(j, M - j));
+                float dk = static_cast<float>(std::min(k, M - k));
+                float r = std::sqrt(di * di + dj * dj + dk * dk);
+
+                float g;
+                if (s > 0)
+                    g = (r > 0) ? std::erf(r / (2 * s)) / r : 1.0f / (s * std::sqrt(PI));
+                else
+                    g = (r > 0) ? 1.0f / r : 1.0f;
+                grid[idx] = Cell(g, 0);
+            }
+        });
+
+        // The table fills the whole doubled grid, so nothing can be pruned
+        fft3(grid, false, false, pool);
+
+        for (std::size_t idx = 0; idx < total; idx++)
+            green[idx] = grid[idx].real();
+    } else {
+        // 4 pi / k^2 per unit volume, with the Gaussian long range filter under P3M
+        const float L = M * h;
+        const float rs = s * h;
+        const float kUnit = 2 * PI / L;
+        pool.parallelFor(total, [&](std::size_t begin, std::size_t end, unsigned) {
+            for (std::size_t idx = begin; idx < end; idx++) {
+                int i = static_cast<int>(idx / (static_cast<std::size_t>(M) * M));
+                int j = static_cast<int>((idx / M) % M);
+                int k = static_cast<int>(idx % M);
+                float kx = kUnit * (i < M / 2 ? i : i - M);
+                float ky = kUnit * (j < M / 2 ? j : j - M);
+                float kz = kUnit * (k < M / 2 ? k : k - M);
+                float k2 = kx * kx + ky * ky + kz * kz;
+
+                // The k = 0 mode is a uniform background and exerts no force
+                green[idx] = (k2 > 0) ? 4 * PI / (k2 * h * h * h) * std::exp(-k2 * rs * rs) : 0.0f;
+            }
+        });
+    }
+}
+
+/*******************************************************************
+                        FFT
+********************************************************************/
+
+void ParticleMesh::prepareTables() {
+    twiddles.resize(M / 2);
+    for (int k = 0; k < M / 2; k++) {
+        double angle = -2.0 * 3.14159265358979323846 * k / M;
+        twiddles[k] = Cell(static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle)));
+    }
+
+    int bits = 0;
+    while ((1 << bits) < M)
+        bits++;
+    bitReverse.resize(M);
+    for (int i = 0; i < M; i++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        bitReverse[i] = r;
+    }
+}
+
+// In-place iterative radix-2 transform of M values, the inverse is normalised by 1 / M
+void ParticleMesh::fftLine(Cell* a, bool inverse) const {
+    for (int i = 0; i < M; i++)
+        if (i < bitReverse[i])
+            std::swap(a[i], a[bitReverse[i]]);
+
+    for (int len = 2; len <= M; len <<= 1) {
+        int half = len / 2;
+        int step = M / len;
+        for (int start = 0; start < M; start += len) {
+            for (int j = 0; j < half; j++) {
+                Cell w = twiddles[j * step];
+                if (inverse) w = std::conj(w);
+                Cell u = a[start + j];
+                Cell v = a[start + j + half] * w;
+                a[start + j] = u + v;
+                a[start + j + half] = u - v;
+            }
+        }
+    }
+
+    if (inverse) {
+        float norm = 1.0f / M;
+        for (int i = 0; i < M; i++)
+            a[i] *= norm;
+    }
+}
+
+// Deposits only fill the first N nodes of each isolated axis, so going forward the z lines
+// outside x, y < N and the y lines outside x < N are still all zero and can be skipped
+void ParticleMesh::fft3(std::vector<Cell>& g, bool inverse, bool pruned, ThreadPool& pool) {
+    const int N = gridSize;
+    const std::size_t plane = static_cast<std::size_t>(M) * M;
+
+    lineScratch.resize(static_cast<std::size_t>(pool.size()) * M);
+
+    // z is innermost in memory and transforms in place, y and x lines are gathered into scratch
+    for (int axis = 2; axis >= 0; axis--) {
+        pool.parallelFor(plane, [&](std::size_t begin, std::size_t end, unsigned w) {
+            Cell* line = lineScratch.data() + static_cast<std::size_t>(w) * M;
+
+            for (std::size_t l = begin; l < end; l++) {
+                int p = static_cast<int>(l / M), q = static_cast<int>(l % M);
+                std::size_t base, stride;
+                if (axis == 2) {
+                    // Along z: p = x, q = y
+                    if (pruned && (p >= N || q >= N)) continue;
+                    fftLine(g.data() + l * M, inverse);
+                    continue;
+                } else if (axis == 1) {
+                    // Along y: p = x, q = z
+                    if (pruned && p >= N) continue;
+                    base = static_cast<std::size_t>(p) * plane + q;
+                    stride = M;
+                } else {
+                    // Along x: p = y, q = z
+                    base = static_cast<std::size_t>(p) * M + q;
+                    stride = plane;
+                }
+
+                for (int i = 0; i < M; i++)
+                    line[i] = g[base + i * stride];
+                fftLine(line, inverse);
+                for (int i = 0; i < M; i++)
+                    g[base + i * stride] = line[i];
+            }
+        });
+    }
+}
+
+/*******************************************************************
+                        P3M SHORT RANGE
+********************************************************************/
+
+// Counting sort of the bodies into cells no narrower than the cutoff
+void ParticleMesh::buildCells(int n) {
+    const int N = gridSize;
+    const float extent = (boundary == Boundary::Periodic) ? N * h : (N - 1) * h;
+
+    cutoff = CutoffSplits * splitCells * h;
+    cells = std::max(1, std::min(MaxCells, static_cast<int>(extent / cutoff)));
+    cellSize = extent / cells;
+    cellOrigin = origin;
+
+    const std::size_t total = static_cast<std::size_t>(cells) * cells * cells;
+    cellStart.assign(total + 1, 0);
+    cellOrder.resize(n);
+
+    std::vector<int> cellOf(n);
+    for (int p = 0; p < n; p++) {
+        int c[3];
+        float u[3] = {(x[p] - cellOrigin.x) / cellSize, (y[p] - cellOrigin.y) / cellSize, (z[p] - cellOrigin.z) / cellSize};
+        for (int a = 0; a < 3; a++) {
+            int v = static_cast<int>(std::floor(u[a]));
+            c[a] = (boundary == Boundary::Periodic) ? wrap(v, cells) : std::min(std::max(v, 0), cells - 1);
+        }
+        cellOf[p] = (c[0] * cells + c[1]) * cells + c[2];
+        cellStart[cellOf[p] + 1]++;
+    }
+
+    for (std::size_t c = 0; c < total; c++)
+        cellStart[c + 1] += cellStart[c];
+
+    std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+    for (int p = 0; p < n; p++)
+        cellOrder[fill[cellOf[p]]++] = p;
+}
+
+// The erfc part of 1/r the mesh leaves out, summed over neighbours inside the cutoff
+Vec3f ParticleMesh::shortRange(int i, const Vec3f& pos, float kq, float gm) const {
+    const bool periodic = (boundary == Boundary::Periodic);
+    const float L = gridSize * h;
+    const float rs = splitCells * h;
+    const float cut2 = cutoff * cutoff;
+    const float gaussNorm = 1.0f / (rs * std::sqrt(PI));
+
+    float u[3] = {(pos.x - cellOrigin.x) / cellSize, (pos.y - cellOrigin.y) / cellSize, (pos.z - cellOrigin.z) / cellSize};
+    int lo[3], hi[3];
+    for (int a = 0; a < 3; a++) {
+        int v = static_cast<int>(std::floor(u[a]));
+        v = periodic ? wrap(v, cells) : std::min(std::max(v, 0), cells - 1);
+        if (periodic && cells < 3) {
+            // Every cell is a neighbour, visit each once
+            lo[a] = 0; hi[a] = cells - 1;
+        } else if (periodic) {
+            lo[a] = v - 1; hi[a] = v + 1;
+        } else {
+            lo[a] = std::max(v - 1, 0); hi[a] = std::min(v + 1, cells - 1);
+        }
+    }
+
+    float fx = 0, fy = 0, fz = 0;
+    for (int cx = lo[0]; cx <= hi[0]; cx++)
+    for (int cy = lo[1]; cy <= hi[1]; cy++)
+    for (int cz = lo[2]; cz <= hi[2]; cz++) {
+        int c = (wrap(cx, cells) * cells + wrap(cy, cells)) * cells + wrap(cz, cells);
+        for (int s = cellStart[c]; s < cellStart[c + 1]; s++) {
+            int j = cellOrder[s];
+            if (j == i) continue;
+
+            float dx = pos.x - x[j], dy = pos.y - y[j], dz = pos.z - z[j];
+            if (periodic) {
+                // Nearest image
+                dx -= L * std::round(dx / L);
+                dy -= L * std::round(dy / L);
+                dz -= L * std::round(dz / L);
+            }
+            float r2 = dx * dx + dy * dy + dz * dz;
+            if (r2 == 0 || r2 > cut2) continue;
+
+            float r = std::sqrt(r2);
+            float v = r / (2 * rs);
+            float s2 = (kq * charges[j] - gm * masses[j]) * (std::erfc(v) / r + gaussNorm * std::exp(-v * v)) / r2;
+            fx += dx * s2; fy += dy * s2; fz += dz * s2;
+        }
+    }
+
+    return Vec3f(fx, fy, fz);
+}
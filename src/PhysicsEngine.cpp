@@ -1,145 +1,833 @@
 #include "PhysicsEngine.h"
-#include "Matrix3.h"
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 
-PhysicsObject::PhysicsObject(Object* o, float mass, float charge) {
-    obj = o;
-    this->mass = mass;
-    this->charge = charge;
+// Bodies per tile in the symmetric kernel: two tiles of positions, charges, masses
+// and force accumulators stay well inside L1, a row of tiles inside L2
+static const std::size_t TileSize = 256;
+
+// Emitters per float kernel call in mixed precision, the block sums are added up in double
+static const std::size_t PairBlock = 512;
+
+std::unique_ptr<PhysicsEngine> PhysicsEngine::create(const PhysicsModel& physM) {
+    switch (physM.precision)
+    {
+        case PhysicsModel::Precision::Double:
+            return create(Precision::Double);
+        case PhysicsModel::Precision::Mixed:
+            return create(Precision::Mixed);
+        default:
+            return create(Precision::Float);
+    }
 }
 
-void PhysicsObject::Rotate(float dt) {
-    angularVelocity = angularVelocity + angularAcceleration * dt;
-    Vec3f rotVector = angularVelocity * dt;
-    updateRotation(rotVector);
+std::unique_ptr<PhysicsEngine> PhysicsEngine::create(Precision precision) {
+    if (precision == Precision::Float)
+        return std::unique_ptr<PhysicsEngine>(new PhysicsEngineT<float>(precision));
+    return std::unique_ptr<PhysicsEngine>(new PhysicsEngineT<double>(precision));
 }
 
-void PhysicsObject::updateRotation(Vec3f rot) {
+template <typename Real> PhysicsEngineT<Real>::PhysicsEngineT(Precision precision)
+    : PhysicsEngine(precision), floatPairs(precision != Precision::Double) {}
 
-    rotation = rotation + rot;
-    if (rotation.x > 2 * PI) rotation.x -= 2 * PI;
-    if (rotation.y > 2 * PI) rotation.y -= 2 * PI;
-    if (rotation.z > 2 * PI) rotation.z -= 2 * PI;
+// Load every particle, field and physics setting of a parsed scene
+template <typename Real> void PhysicsEngineT<Real>::loadSimulation(const Simulation* sim) {
+    configure(sim->physicsModel);
 
-    float c, s;
-    c = std::cos(rot.x);
-    s = std::sin(rot.x);
-    std::array<float, 9> xVal = {1, 0, 0, 0, c, -s, 0, s, c};
-    Matrix3 rotMatX = Matrix3(xVal);
-    c = std::cos(rot.y);
-    s = std::sin(rot.y);
-    std::array<float, 9> yVal = {c , 0, s, 0, 1, 0, -s, 0, c};
-    Matrix3 rotMatY = Matrix3(yVal);
-    c = std::cos(rot.z);
-    s = std::sin(rot.z);
-    std::array<float, 9> zVal = {c, -s, 0, s, c, 0, 0, 0, 1};
-    Matrix3 rotMatZ = Matrix3(zVal);
+    for (const ObjectModel& objM : sim->objModels) {
+        std::size_t i = particles.add(Vec(objM.center), Vec(objM.initVelocity), static_cast<Real>(objM.mass), static_cast<Real>(objM.charge), objM.radius);
+        particles.setSpin(i, objM.initAngVelocity, objM.initAngAccel);
+    }
+
+    for (const FieldModel& fieldM : sim->fieldModels)
+        fields.push_back(Field(fieldM));
 
-    Matrix3 rotMat = rotMatY * rotMatX * rotMatZ;
+    refreshFloatCopies();
+}
+
+Field::Field(const FieldModel& fieldM) {
+    switch (fieldM.type)
+    {
+        case FieldModel::Type::Electric:
+            type = Field::Type::Electric;
+            break;
+        case FieldModel::Type::Magnetic:
+            type = Field::Type::Magnetic;
+            break;
+    }
+
+    Vec3f dir = fieldM.direction;
+    direction = dir.normalize();
+    strength = fieldM.strength;
+    current = direction * strength;
+
+    if (!fieldM.strengthExpr.empty()) {
+        strengthExpr = Expression(fieldM.strengthExpr);
+        hasStrengthExpr = true;
+    }
+    if (!fieldM.directionExpr[0].empty()) {
+        for (int c = 0; c < 3; c++)
+            directionExpr[c] = Expression(fieldM.directionExpr[c]);
+        hasDirectionExpr = true;
+    }
 
-    for (Vec3f& vert : obj->vertices) {
-        vert = vert - obj->center;
-        vert = rotMat * vert;
-        vert = vert + obj->center;
+    if (!fieldM.grid.empty()) {
+        grid = FieldGrid::open(fieldM.grid);
+        block = fieldM.gridBlock;
+        if (block < 0 || block >= grid->blockCount())
+            throw std::runtime_error("Field " + fieldM.name + " asks for grid block " + std::to_string(block) +
+                                     " but " + fieldM.grid + " has " + std::to_string(grid->blockCount()));
     }
+}
+
+float Field::strengthAt(float t, const Vec3f& p) const {
+    return hasStrengthExpr ? strengthExpr.evaluate(t, p.x, p.y, p.z) : strength;
+}
+
+Vec3f Field::directionAt(float t, const Vec3f& p) const {
+    if (!hasDirectionExpr)
+        return direction;
 
+    Vec3f d(directionExpr[0].evaluate(t, p.x, p.y, p.z),
+            directionExpr[1].evaluate(t, p.x, p.y, p.z),
+            directionExpr[2].evaluate(t, p.x, p.y, p.z));
+    float mag = d.magnitude();
+    return (mag > 0) ? d * (1.f / mag) : Vec3f();
 }
 
-void PhysicsEngine::eulerRotate(const std::vector<PhysicsObject*> scene, float dt) {
-    for (auto Pobj : scene)
-        Pobj->Rotate(dt);
+bool Field::dependsOnTime() const {
+    if (hasStrengthExpr && strengthExpr.dependsOnTime())
+        return true;
+    if (hasDirectionExpr && !grid)
+        for (int c = 0; c < 3; c++)
+            if (directionExpr[c].dependsOnTime())
+                return true;
+    return false;
 }
 
-void PhysicsEngine::integrateForward(const std::vector<PhysicsObject*> scene, const std::vector<Field> fields, float t, float dt) {
-    int N = scene.size();
-    // For each particle, we’ll compute k1..k4
-    std::vector<State>  y0(N), k1(N), k2(N), k3(N), k4(N);
-    std::vector<State>  tempY(N);
+bool Field::dependsOnPosition() const {
+    if (grid || (hasStrengthExpr && strengthExpr.dependsOnPosition()))
+        return true;
+    if (hasDirectionExpr)
+        for (int c = 0; c < 3; c++)
+            if (directionExpr[c].dependsOnPosition())
+                return true;
+    return false;
+}
 
-    // 1) Collect initial states
-    for (int i = 0; i < N; ++i) {
-        y0[i] = getState(scene[i]);
+void PhysicsEngine::configure(const PhysicsModel& physM) {
+    switch (physM.forceMethod)
+    {
+        case PhysicsModel::ForceMethod::AllPairs:
+            forceMethod = ForceMethod::AllPairs;
+            break;
+        case PhysicsModel::ForceMethod::BarnesHut:
+            forceMethod = ForceMethod::BarnesHut;
+            break;
+        case PhysicsModel::ForceMethod::Tiled:
+            forceMethod = ForceMethod::Tiled;
+            break;
+        case PhysicsModel::ForceMethod::ParticleMesh:
+            forceMethod = ForceMethod::ParticleMesh;
+            break;
     }
+    theta = physM.theta;
 
-    // 2) k1 = f(t, y0)
-    for (int i = 0; i < N; ++i) {
-        auto d = evaluate(scene, fields, i, y0[i], t);
-        k1[i] = { d.r, d.v };
+    switch (physM.integrator)
+    {
+        case PhysicsModel::Integrator::RK4:
+            integrator = Integrator::RK4;
+            break;
+        case PhysicsModel::Integrator::DormandPrince:
+            integrator = Integrator::DormandPrince;
+            break;
+        case PhysicsModel::Integrator::Boris:
+            integrator = Integrator::Boris;
+            break;
+        case PhysicsModel::Integrator::BlockStep:
+            integrator = Integrator::BlockStep;
+            break;
     }
+    absTol = physM.absTol;
+    relTol = physM.relTol;
+    maxLevel = std::min(std::max(physM.maxLevel, 0), 20);
+    eta = physM.eta;
+    collisions = physM.collisions;
+    restitution = std::min(std::max(physM.restitution, 0.0f), 1.0f);
 
-    // 3) k2 = f(t + dt/2, y0 + k1/2)
-    for (int i = 0; i < N; ++i) {
-        tempY[i] = stateAdd(y0[i], k1[i], 0.5f);
+    switch (physM.simd)
+    {
+        case PhysicsModel::SimdPath::Auto:
+            setKernelPath(PairKernel::detect());
+            break;
+        case PhysicsModel::SimdPath::Scalar:
+            setKernelPath(PairKernel::Path::Scalar);
+            break;
+        case PhysicsModel::SimdPath::AVX2:
+            setKernelPath(PairKernel::Path::AVX2);
+            break;
+        case PhysicsModel::SimdPath::AVX512:
+            setKernelPath(PairKernel::Path::AVX512);
+            break;
     }
-    for (int i = 0; i < N; ++i) {
-        auto d = evaluate(scene, fields, i, tempY[i], t + dt*0.5f);
-        k2[i] = { d.r, d.v };
+    setThreadCount(static_cast<unsigned>(std::max(physM.threads, 0)));
+}
+
+// The mesh is the only part of the configuration that belongs to one precision
+template <typename Real> void PhysicsEngineT<Real>::configure(const PhysicsModel& physM) {
+    PhysicsEngine::configure(physM);
+
+    ParticleMesh::Boundary boundary = (physM.pmBoundary == PhysicsModel::PmBoundary::Periodic)
+        ? ParticleMesh::Boundary::Periodic : ParticleMesh::Boundary::Isolated;
+    mesh.configure(physM.pmGrid, boundary, physM.pmBox, physM.p3m ? physM.p3mSplit : 0.0f);
+}
+
+void PhysicsEngine::setThreadCount(unsigned threads) {
+    pool.reset(new ThreadPool(threads));
+}
+
+unsigned PhysicsEngine::threadCount() {
+    return workers().size();
+}
+
+void PhysicsEngine::setKernelPath(PairKernel::Path path) {
+    PairKernel::Path best = PairKernel::detect();
+    kernelPath = (static_cast<int>(path) > static_cast<int>(best)) ? best : path;
+}
+
+// The pool is created on first use with one thread per core
+ThreadPool& PhysicsEngine::workers() {
+    if (!pool)
+        pool.reset(new ThreadPool(0));
+    return *pool;
+}
+
+template <typename Real> void PhysicsEngineT<Real>::integrateForward(double t, double dt) {
+    switch (integrator)
+    {
+        case Integrator::RK4:
+            stepRK4(static_cast<Real>(t), static_cast<Real>(dt));
+            break;
+        case Integrator::DormandPrince:
+            stepDormandPrince(static_cast<Real>(t), static_cast<Real>(dt));
+            break;
+        case Integrator::Boris:
+            stepBoris(static_cast<Real>(t), static_cast<Real>(dt));
+            break;
+        case Integrator::BlockStep:
+            stepBlock(static_cast<Real>(t), static_cast<Real>(dt));
+            break;
     }
 
-    // 4) k3 = f(t + dt/2, y0 + k2/2)
-    for (int i = 0; i < N; ++i) {
-        tempY[i] = stateAdd(y0[i], k2[i], 0.5f);
+    integrateRotation(static_cast<float>(dt));
+
+    if (collisions)
+        resolveCollisions();
+}
+
+// Orientations are only ever multiplied by unit rotations and renormalized, so they stay exact
+// rotations instead of accumulating error the way repeatedly rotated vertices do
+template <typename Real> void PhysicsEngineT<Real>::integrateRotation(float dt) {
+    const int N = particles.size();
+    workers().parallelFor(N, [&](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t i = begin; i < end; i++) {
+            Vec3f w = particles.angularVelocity(i);
+            Vec3f alpha(particles.alphaX[i], particles.alphaY[i], particles.alphaZ[i]);
+            if (w.x == 0 && w.y == 0 && w.z == 0 && alpha.x == 0 && alpha.y == 0 && alpha.z == 0)
+                continue;
+
+            // Turning by the midpoint rate is exact for a constant acceleration about a fixed axis
+            Vec3f wMid = w + alpha * (dt * 0.5f);
+            Quaternion q = (Quaternion::fromRotationVector(wMid * dt) * particles.orientation(i)).normalize();
+            particles.qw[i] = q.w; particles.qx[i] = q.x; particles.qy[i] = q.y; particles.qz[i] = q.z;
+
+            w = w + alpha * dt;
+            particles.wx[i] = w.x; particles.wy[i] = w.y; particles.wz[i] = w.z;
+        }
+    });
+}
+
+// Push overlapping spheres apart and exchange the normal impulse of each contact
+// Contacts are handled one after another in index order, so a body touching several others sees the
+// earlier corrections. Bodies with no mass are treated as immovable.
+template <typename Real> void PhysicsEngineT<Real>::resolveCollisions() {
+    const int N = particles.size();
+    floatPositions(particles);
+    hash.build(stageX, stageY, stageZ, particles.radius.data(), N, workers());
+    const std::vector<SpatialHash::Contact>& contacts = hash.findContacts(workers());
+    stats.contacts += contacts.size();
+
+    for (const SpatialHash::Contact& c : contacts) {
+        const int i = c.i, j = c.j;
+        Real wi = (particles.mass[i] > 0) ? 1.0f / particles.mass[i] : 0.0f;
+        Real wj = (particles.mass[j] > 0) ? 1.0f / particles.mass[j] : 0.0f;
+        if (wi + wj == 0) continue;
+
+        // Earlier contacts may already have separated the pair
+        Vec d = particles.position(j) - particles.position(i);
+        Real dist = d.magnitude();
+        Real overlap = particles.radius[i] + particles.radius[j] - dist;
+        if (overlap <= 0) continue;
+
+        // Coincident centres separate along their relative velocity, or x if they have none
+        Vec n;
+        if (dist > 0) {
+            n = d * (1.0f / dist);
+        } else {
+            Vec rel = particles.velocity(i) - particles.velocity(j);
+            Real speed = rel.magnitude();
+            n = (speed > 0) ? rel * (1.0f / speed) : Vec(1, 0, 0);
+        }
+
+        Vec shift = n * (overlap / (wi + wj));
+        particles.x[i] -= shift.x * wi; particles.y[i] -= shift.y * wi; particles.z[i] -= shift.z * wi;
+        particles.x[j] += shift.x * wj; particles.y[j] += shift.y * wj; particles.z[j] += shift.z * wj;
+
+        // Only approaching pairs get an impulse
+        Real vn = (particles.velocity(j) - particles.velocity(i)).dot(n);
+        if (vn >= 0) continue;
+
+        Vec impulse = n * (-(1 + restitution) * vn / (wi + wj));
+        particles.vx[i] -= impulse.x * wi; particles.vy[i] -= impulse.y * wi; particles.vz[i] -= impulse.z * wi;
+        particles.vx[j] += impulse.x * wj; particles.vy[j] += impulse.y * wj; particles.vz[j] += impulse.z * wj;
     }
-    for (int i = 0; i < N; ++i) {
-        auto d = evaluate(scene, fields, i, tempY[i], t + dt*0.5f);
-        k3[i] = { d.r, d.v };
+}
+
+template <typename Real> void PhysicsEngineT<Real>::resetIntegrator() {
+    dpStep = 0;
+    blockPrimed = false;
+}
+
+template <typename Real> void PhysicsEngineT<Real>::stepRK4(Real t, Real dt) {
+    int N = particles.size();
+    k1.resize(N); k2.resize(N); k3.resize(N); k4.resize(N);
+    tempY.resize(N);
+
+    // 1) The particle store itself is the initial state y0
+    const State& y0 = particles;
+
+    // 2) k1 = f(t, y0)
+    evaluateStage(y0, k1, t);
+
+    // 3) k2 = f(t + dt/2, y0 + k1*dt/2)
+    stateAdd(y0, k1, dt * 0.5f, tempY);
+    evaluateStage(tempY, k2, t + dt*0.5f);
+
+    // 4) k3 = f(t + dt/2, y0 + k2*dt/2)
+    stateAdd(y0, k2, dt * 0.5f, tempY);
+    evaluateStage(tempY, k3, t + dt*0.5f);
+
+    // 5) k4 = f(t + dt, y0 + k3*dt)
+    stateAdd(y0, k3, dt, tempY);
+    evaluateStage(tempY, k4, t + dt);
+
+    // 6) Combine into final state
+    const Real w = dt / 6.0f;
+    workers().parallelFor(N, [&](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t i = begin; i < end; ++i) {
+            particles.x[i] += (k1.x[i] + 2.0f*k2.x[i] + 2.0f*k3.x[i] + k4.x[i]) * w;
+            particles.y[i] += (k1.y[i] + 2.0f*k2.y[i] + 2.0f*k3.y[i] + k4.y[i]) * w;
+            particles.z[i] += (k1.z[i] + 2.0f*k2.z[i] + 2.0f*k3.z[i] + k4.z[i]) * w;
+
+            particles.vx[i] += (k1.vx[i] + 2.0f*k2.vx[i] + 2.0f*k3.vx[i] + k4.vx[i]) * w;
+            particles.vy[i] += (k1.vy[i] + 2.0f*k2.vy[i] + 2.0f*k3.vy[i] + k4.vy[i]) * w;
+            particles.vz[i] += (k1.vz[i] + 2.0f*k2.vz[i] + 2.0f*k3.vz[i] + k4.vz[i]) * w;
+        }
+    });
+}
+
+// Drift-kick-drift with the Boris rotation for q v x B
+// Velocity-independent forces (interparticle and electric) give two half kicks around an exact
+// rotation about B, so |v| is untouched by the magnetic field and gyro orbits stay closed
+template <typename Real> void PhysicsEngineT<Real>::stepBoris(Real t, Real dt) {
+    int N = particles.size();
+    tempY.resize(N);
+
+    // Half drift to the midpoint
+    workers().parallelFor(N, [&](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t i = begin; i < end; ++i) {
+            tempY.x[i] = particles.x[i] + particles.vx[i] * dt * 0.5f;
+            tempY.y[i] = particles.y[i] + particles.vy[i] * dt * 0.5f;
+            tempY.z[i] = particles.z[i] + particles.vz[i] * dt * 0.5f;
+            tempY.vx[i] = particles.vx[i];
+            tempY.vy[i] = particles.vy[i];
+            tempY.vz[i] = particles.vz[i];
+        }
+    });
+
+    prepareForces(tempY, t + dt * 0.5f);
+    stats.forceEvaluations += N;
+
+    workers().parallelFor(N, [&](std::size_t begin, std::size_t end, unsigned) {
+        for (int i = begin; i < static_cast<int>(end); ++i) {
+            Real qm = particles.charge[i] / particles.mass[i];
+            Vec B = magneticField(i);
+            Vec halfKick = computeForce(tempY, i, false) * (dt * 0.5f / particles.mass[i]);
+
+            // v- = v + a dt/2
+            Vec vMinus = particles.velocity(i) + halfKick;
+
+            Vec vPlus = gyrate(vMinus, B, qm, dt);
+
+            // v = v+ + a dt/2
+            Vec v = vPlus + halfKick;
+            particles.vx[i] = v.x;
+            particles.vy[i] = v.y;
+            particles.vz[i] = v.z;
+
+            // Second half drift with the new velocity
+            particles.x[i] = tempY.x[i] + v.x * dt * 0.5f;
+            particles.y[i] = tempY.y[i] + v.y * dt * 0.5f;
+            particles.z[i] = tempY.z[i] + v.z * dt * 0.5f;
+        }
+    });
+}
+
+// Rotate v about B by the exact gyro angle of a step h (tan-corrected so large steps keep the phase)
+template <typename Real> typename PhysicsEngineT<Real>::Vec PhysicsEngineT<Real>::gyrate(const Vec& v, const Vec& B, Real qm, Real h) {
+    Vec b = B;
+    Real Bmag = b.magnitude();
+    if (!(Bmag > 0) || h == 0)
+        return v;
+    Vec w = v;
+    Vec tv = B * (std::tan(qm * Bmag * h * 0.5f) / Bmag);
+    Real s = 2.f / (1.f + tv.dot(tv));
+    Vec vPrime = w + w.cross(tv);
+    return w + vPrime.cross(tv) * s;
+}
+
+// Block time-stepping (kick-drift-kick leapfrog on power-of-two levels)
+// dt is split into 2^maxLevel ticks and particles on level l end a step every 2^(maxLevel - l) ticks.
+// Only ticks where the finest occupied level ends a step are visited: everyone drifts up to the tick
+// in one pass, and only the particles due there get new forces and kicks.
+// Each call opens with a half kick and the last tick, where every level ends, only closes,
+// so stored velocities are in step with the positions between calls and dt may change freely.
+// Magnetic fields rotate the velocity Boris style around every kick, half a particle step on each side,
+// so q v x B never acts through a stale velocity and keeps |v|.
+template <typename Real> void PhysicsEngineT<Real>::stepBlock(Real t, Real dt) {
+    const int N = particles.size();
+    const int ticks = 1 << maxLevel;
+    const Real tick = dt / ticks;
+
+    // The tiled kernel always covers every pair, so single particles use the all-pairs kernel
+    const ForceMethod method = forceMethod == ForceMethod::Tiled ? ForceMethod::AllPairs : forceMethod;
+    const bool rebuilt = method == ForceMethod::BarnesHut || method == ForceMethod::ParticleMesh;
+
+    if (!blockPrimed || static_cast<int>(blockLevel.size()) != N) {
+        // Start everyone on the finest level with a fresh force
+        blockLevel.assign(N, maxLevel);
+        blockAx.resize(N); blockAy.resize(N); blockAz.resize(N);
+
+        prepareForces(particles, t, method);
+        workers().parallelFor(N, [&](std::size_t begin, std::size_t end, unsigned) {
+            for (int i = begin; i < static_cast<int>(end); i++) {
+                Vec a = computeForce(particles, i, method, false) * (1.f / particles.mass[i]);
+                blockAx[i] = a.x; blockAy[i] = a.y; blockAz[i] = a.z;
+            }
+        });
+        stats.forceEvaluations += N;
+        blockPrimed = true;
+    } else if (fieldsVary()) {
+        // The opening rotations need B where the particles are now
+        floatPositions(particles);
+        updateFields(particles, t);
     }
 
-    // 5) k4 = f(t + dt, y0 + k3)
-    for (int i = 0; i < N; ++i) {
-        tempY[i] = stateAdd(y0[i], k3[i], 1.0f);
+    levelCount.assign(maxLevel + 1, 0);
+    for (int i = 0; i < N; i++)
+        levelCount[blockLevel[i]]++;
+
+    // Open every particle's first step with the force the last call closed on
+    workers().parallelFor(N, [&](std::size_t begin, std::size_t end, unsigned) {
+        for (int i = begin; i < static_cast<int>(end); i++) {
+            Real half = dt / (1 << blockLevel[i]) * 0.5f;
+            Vec v = particles.velocity(i) + Vec(blockAx[i], blockAy[i], blockAz[i]) * half;
+            v = gyrate(v, magneticField(i), particles.charge[i] / particles.mass[i], half);
+            particles.vx[i] = v.x; particles.vy[i] = v.y; particles.vz[i] = v.z;
+        }
+    });
+
+    int k = 0;
+    while (k < ticks) {
+        // Next tick where the finest occupied level ends a step
+        int finest = maxLevel;
+        while (finest > 0 && levelCount[finest] == 0)
+            finest--;
+        const int stride = 1 << (maxLevel - finest);
+        const int next = (k / stride + 1) * stride;
+
+        // Drift every particle up to it
+        const Real span = (next - k) * tick;
+        workers().parallelFor(N, [&](std::size_t begin, std::size_t end, unsigned) {
+            for (std::size_t i = begin; i < end; i++) {
+                particles.x[i] += particles.vx[i] * span;
+                particles.y[i] += particles.vy[i] * span;
+                particles.z[i] += particles.vz[i] * span;
+            }
+        });
+        k = next;
+
+        // Particles whose step ends on this tick
+        activeList.clear();
+        for (int i = 0; i < N; i++)
+            if (k % (1 << (maxLevel - blockLevel[i])) == 0)
+                activeList.push_back(i);
+        if (activeList.empty()) continue;
+        for (int i : activeList)
+            levelCount[blockLevel[i]]--;
+
+        // A tree or mesh costs the whole N to rebuild, so a small active set reuses the last one:
+        // its leaves and the short range part read the drifted positions, its cells lag by a few ticks
+        const bool last = k == ticks;
+        if (rebuilt && (last || activeList.size() * 8 >= static_cast<std::size_t>(N))) {
+            prepareForces(particles, t + k * tick, method);
+        } else {
+            // The vector kernels and the tree leaves read the float positions, which have to follow the drift
+            floatPositions(particles);
+            if (fieldsVary())
+                updateFields(particles, t + k * tick);
+        }
+
+        workers().parallelFor(activeList.size(), [&](std::size_t begin, std::size_t end, unsigned) {
+            for (std::size_t n = begin; n < end; n++) {
+                int i = activeList[n];
+                Vec a = computeForce(particles, i, method, false) * (1.f / particles.mass[i]);
+
+                // Close the old step, pick a level, open the new step unless dt ends here
+                Real dtOld = dt / (1 << blockLevel[i]);
+                int level = chooseLevel(i, a, dtOld, dt);
+                // Coarser levels are only allowed where their boundaries line up with this tick
+                while (level < blockLevel[i] && k % (1 << (maxLevel - level)) != 0)
+                    level++;
+                Real dtNew = last ? 0 : dt / (1 << level);
+
+                const Real qm = particles.charge[i] / particles.mass[i];
+                const Vec B = magneticField(i);
+                Vec v = gyrate(particles.velocity(i), B, qm, dtOld * 0.5f);
+                v = v + a * (0.5f * (dtOld + dtNew));
+                v = gyrate(v, B, qm, dtNew * 0.5f);
+                particles.vx[i] = v.x; particles.vy[i] = v.y; particles.vz[i] = v.z;
+
+                blockAx[i] = a.x; blockAy[i] = a.y; blockAz[i] = a.z;
+                blockLevel[i] = level;
+            }
+        });
+        for (int i : activeList)
+            levelCount[blockLevel[i]]++;
+        stats.forceEvaluations += activeList.size();
     }
-    for (int i = 0; i < N; ++i) {
-        auto d = evaluate(scene, fields, i, tempY[i], t + dt);
-        k4[i] = { d.r, d.v };
+}
+
+// Finest needed level from dt_i = eta * |a| / |da/dt|, with da/dt taken across the particle's last step
+template <typename Real> int PhysicsEngineT<Real>::chooseLevel(int i, const Vec& a, Real dtOld, Real dt) {
+    Vec jerk = (a - Vec(blockAx[i], blockAy[i], blockAz[i])) * (1.f / dtOld);
+    Real j = jerk.magnitude();
+    Vec acc = a;
+    Real aMag = acc.magnitude();
+    if (j <= 0 || aMag <= 0) return 0;
+
+    Real dtWanted = eta * aMag / j;
+    int level = 0;
+    while (level < maxLevel && dt / (1 << level) > dtWanted)
+        level++;
+    return level;
+}
+
+// Sum of every uniform magnetic field
+// Total B on particle i at the positions of the last prepareForces
+template <typename Real> typename PhysicsEngineT<Real>::Vec PhysicsEngineT<Real>::magneticField(int i) {
+    Vec B;
+    for (const Field& f : fields)
+        if (f.type == Field::Type::Magnetic)
+            B = B + Vec(f.at(i));
+    return B;
+}
+
+template <typename Real> bool PhysicsEngineT<Real>::fieldsVary() const {
+    for (const Field& f : fields)
+        if (f.dependsOnTime() || f.dependsOnPosition())
+            return true;
+    return false;
+}
+
+// Field vectors at time t: uniform fields once, spatially varying ones at every position
+// Grid fields are sampled 8 at a time on AVX2, scaled by strength when it is uniform in space
+template <typename Real> void PhysicsEngineT<Real>::updateFields(const State& y, float t) {
+    const int N = y.size();
+    const Vec3f origin;
+
+    for (Field& f : fields) {
+        f.sampled = f.dependsOnPosition();
+        if (!f.sampled) {
+            f.current = f.directionAt(t, origin) * f.strengthAt(t, origin);
+            continue;
+        }
+
+        f.sampleX.resize(N); f.sampleY.resize(N); f.sampleZ.resize(N);
+        const bool localStrength = f.hasStrengthExpr && f.strengthExpr.dependsOnPosition();
+        workers().parallelFor(N, [&](std::size_t begin, std::size_t end, unsigned) {
+            if (f.grid) {
+                float scale = localStrength ? 1.0f : f.strengthAt(t, origin);
+                f.grid->sampleMany(kernelPath, f.block, stageX, stageY, stageZ, begin, end, scale,
+                                   f.sampleX.data(), f.sampleY.data(), f.sampleZ.data());
+                if (!localStrength) return;
+            }
+
+            for (std::size_t i = begin; i < end; i++) {
+                Vec3f p(stageX[i], stageY[i], stageZ[i]);
+                float s = f.strengthAt(t, p);
+                Vec3f v = f.grid ? Vec3f(f.sampleX[i], f.sampleY[i], f.sampleZ[i]) * s : f.directionAt(t, p) * s;
+                f.sampleX[i] = v.x; f.sampleY[i] = v.y; f.sampleZ[i] = v.z;
+            }
+        });
     }
+}
 
-    // 6) Combine into final state
-    for (int i = 0; i < N; ++i) {
-        Vec3f dr = (k1[i].r + k2[i].r*2.0f + k3[i].r*2.0f + k4[i].r) * (1.f / 6.0f);
-        Vec3f dv = (k1[i].v + k2[i].v*2.0f + k3[i].v*2.0f + k4[i].v) * (1.f / 6.0f);
+// Dormand-Prince 5(4) tableau, each fraction rounded straight to the precision it is used in
+template <typename Real> struct DormandPrince {
+    static constexpr Real C[7] = { 0, Real(1)/5, Real(3)/10, Real(4)/5, Real(8)/9, 1, 1 };
+    static constexpr Real A2[1] = { Real(1)/5 };
+    static constexpr Real A3[2] = { Real(3)/40, Real(9)/40 };
+    static constexpr Real A4[3] = { Real(44)/45, Real(-56)/15, Real(32)/9 };
+    static constexpr Real A5[4] = { Real(19372)/6561, Real(-25360)/2187, Real(64448)/6561, Real(-212)/729 };
+    static constexpr Real A6[5] = { Real(9017)/3168, Real(-355)/33, Real(46732)/5247, Real(49)/176, Real(-5103)/18656 };
+    // 5th order solution, also the last stage's state (first same as last)
+    static constexpr Real B[6] = { Real(35)/384, 0, Real(500)/1113, Real(125)/192, Real(-2187)/6784, Real(11)/84 };
+    // 5th minus 4th order weights over all 7 stages
+    static constexpr Real E[7] = { Real(71)/57600, 0, Real(-71)/16695, Real(71)/1920, Real(-17253)/339200, Real(22)/525, Real(-1)/40 };
+};
+
+// Adaptive steps from t to t + dt with error control on every position and velocity component
+template <typename Real> void PhysicsEngineT<Real>::stepDormandPrince(Real t, Real dt) {
+    typedef DormandPrince<Real> DP;
+    int N = particles.size();
+    k1.resize(N); k2.resize(N); k3.resize(N); k4.resize(N);
+    k5.resize(N); k6.resize(N); k7.resize(N);
+    tempY.resize(N); nextY.resize(N);
+    if (N == 0 || dt <= 0) return;
+
+    // Time is tracked in double so many small steps still land on t + dt
+    const double tEnd = static_cast<double>(t) + dt;
+    double tNow = t;
+    Real h = (dpStep > 0) ? dpStep : dt;
+    const Real hMin = dt * 1e-7f;
+
+    evaluateStage(particles, k1, t);
+
+    while (tNow < tEnd) {
+        Real remaining = static_cast<Real>(tEnd - tNow);
+        bool truncated = false;
+        if (h >= remaining) {
+            h = remaining;
+            truncated = true;
+        }
+        Real ts = static_cast<Real>(tNow);
+
+        const State* ks[6] = { &k1, &k2, &k3, &k4, &k5, &k6 };
+        stateCombine(particles, h, DP::A2, ks, 1, tempY);
+        evaluateStage(tempY, k2, ts + DP::C[1] * h);
+        stateCombine(particles, h, DP::A3, ks, 2, tempY);
+        evaluateStage(tempY, k3, ts + DP::C[2] * h);
+        stateCombine(particles, h, DP::A4, ks, 3, tempY);
+        evaluateStage(tempY, k4, ts + DP::C[3] * h);
+        stateCombine(particles, h, DP::A5, ks, 4, tempY);
+        evaluateStage(tempY, k5, ts + DP::C[4] * h);
+        stateCombine(particles, h, DP::A6, ks, 5, tempY);
+        evaluateStage(tempY, k6, ts + DP::C[5] * h);
+        stateCombine(particles, h, DP::B, ks, 6, nextY);
+        evaluateStage(nextY, k7, ts + h);
 
-        scene[i]->obj->center = scene[i]->obj->center + (dr * dt);
-        for (Vec3f& vert : scene[i]->obj->vertices)
-            vert = vert + (dr * dt);
+        Real err = errorNorm(particles, nextY, h);
 
-        scene[i]->velocity = scene[i]->velocity + (dv * dt);   // advance velocity
+        if (err <= 1.f || h <= hMin) {
+            // Accept: the new state becomes current and its derivative is the next k1
+            std::swap(static_cast<State&>(particles), nextY);
+            std::swap(k1, k7);
+            tNow += h;
+            stats.accepted++;
+            stats.lastStep = h;
+
+            Real factor = (err > 0) ? 0.9f * std::pow(err, -0.2f) : 5.f;
+            factor = std::min<Real>(5.f, std::max<Real>(0.2f, factor));
+            // A step cut short to land on t + dt shouldn't shrink the next call's guess
+            dpStep = truncated ? std::max(dpStep, h * factor) : h * factor;
+            h = dpStep;
+        } else {
+            stats.rejected++;
+            h *= std::max<Real>(0.2f, 0.9f * std::pow(err, -0.25f));
+            h = std::max(h, hMin);
+        }
     }
 }
 
-PhysicsEngine::State PhysicsEngine::getState(const PhysicsObject* p) {
-    return { p->obj->center, p->velocity };
+// One of the six phase-space components by index
+template <typename Real> static const AlignedArray<Real>& component(const PhaseSpaceT<Real>& p, int c) {
+    switch (c)
+    {
+        case 0: return p.x;
+        case 1: return p.y;
+        case 2: return p.z;
+        case 3: return p.vx;
+        case 4: return p.vy;
+        default: return p.vz;
+    }
 }
 
-PhysicsEngine::State PhysicsEngine::stateAdd(const State& s, const State& d, float dt) {
-    return { s.r + (d.r * dt), s.v + (d.v * dt) };
+// RMS of the embedded error estimate scaled by absTol + relTol * |y|
+template <typename Real> Real PhysicsEngineT<Real>::errorNorm(const State& y0, const State& y1, Real h) {
+    const std::size_t N = y0.size();
+    threadSums.assign(workers().size(), 0.0);
+
+    workers().parallelFor(N, [&](std::size_t begin, std::size_t end, unsigned w) {
+        const State* ks[7] = { &k1, &k2, &k3, &k4, &k5, &k6, &k7 };
+
+        double sum = 0;
+        for (int c = 0; c < 6; c++) {
+            const AlignedArray<Real>& a0 = component(y0, c);
+            const AlignedArray<Real>& a1 = component(y1, c);
+            for (std::size_t i = begin; i < end; i++) {
+                Real e = 0;
+                for (int s = 0; s < 7; s++)
+                    e += DormandPrince<Real>::E[s] * component(*ks[s], c)[i];
+                Real scale = absTol + relTol * std::max(std::fabs(a0[i]), std::fabs(a1[i]));
+                Real r = h * e / scale;
+                sum += static_cast<double>(r) * r;
+            }
+        }
+        threadSums[w] = sum;
+    });
+
+    // Reduce in worker order so the norm is reproducible
+    double total = 0;
+    for (double s : threadSums)
+        total += s;
+    return static_cast<Real>(std::sqrt(total / (6.0 * N)));
 }
 
-PhysicsEngine::State PhysicsEngine::evaluate(const std::vector<PhysicsObject*> scene, const std::vector<Field> fields, int i, const State& s, float t) {
-    Vec3f F = computeForce(scene, fields, i);
-    return { s.v, F * (1.f / scene[i]->mass) };
+// out = s + h * sum(a[j] * d[j]) for every component
+template <typename Real> void PhysicsEngineT<Real>::stateCombine(const State& s, Real h, const Real* a, const State* const* d, int count, State& out) {
+    workers().parallelFor(s.size(), [&](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t i = begin; i < end; ++i) {
+            Real dx = 0, dy = 0, dz = 0, dvx = 0, dvy = 0, dvz = 0;
+            for (int j = 0; j < count; j++) {
+                const State& k = *d[j];
+                dx += a[j] * k.x[i];
+                dy += a[j] * k.y[i];
+                dz += a[j] * k.z[i];
+                dvx += a[j] * k.vx[i];
+                dvy += a[j] * k.vy[i];
+                dvz += a[j] * k.vz[i];
+            }
+            out.x[i] = s.x[i] + h * dx;
+            out.y[i] = s.y[i] + h * dy;
+            out.z[i] = s.z[i] + h * dz;
+            out.vx[i] = s.vx[i] + h * dvx;
+            out.vy[i] = s.vy[i] + h * dvy;
+            out.vz[i] = s.vz[i] + h * dvz;
+        }
+    });
 }
 
-Vec3f PhysicsEngine::computeForce(const std::vector<PhysicsObject*> scene, const std::vector<Field> fields, int i) {
-    int N = scene.size();
+// out = s + d * dt for every component
+template <typename Real> void PhysicsEngineT<Real>::stateAdd(const State& s, const State& d, Real dt, State& out) {
+    workers().parallelFor(s.size(), [&](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t i = begin; i < end; ++i) {
+            out.x[i] = s.x[i] + d.x[i] * dt;
+            out.y[i] = s.y[i] + d.y[i] * dt;
+            out.z[i] = s.z[i] + d.z[i] * dt;
+            out.vx[i] = s.vx[i] + d.vx[i] * dt;
+            out.vy[i] = s.vy[i] + d.vy[i] * dt;
+            out.vz[i] = s.vz[i] + d.vz[i] * dt;
+        }
+    });
+}
 
-    Vec3f force = Vec3f();
-    for (int j = 0; j < N; j++) {
-        if (i == j) continue;
-        force = force + computeColoumbForce(scene[i], scene[j]);
-        force = force + computeGravitationalForce(scene[i], scene[j]);
+// Per-stage setup at time t: field vectors, then build the tree, solve the mesh or run the tiled sum
+template <typename Real> void PhysicsEngineT<Real>::prepareForces(const State& y, Real t, ForceMethod method) {
+    int N = y.size();
+    floatPositions(y);
+    updateFields(y, t);
+
+    if (method == ForceMethod::BarnesHut)
+        tree.build(stageX, stageY, stageZ, floatCharges(), floatMasses(), N);
+    else if (method == ForceMethod::ParticleMesh)
+        mesh.solve(stageX, stageY, stageZ, floatCharges(), floatMasses(), N, workers());
+    else if (method == ForceMethod::Tiled)
+        computeTiledForces(y);
+}
+
+// Derivatives of every particle at the stage state y
+template <typename Real> void PhysicsEngineT<Real>::evaluateStage(const State& y, State& k, Real t) {
+    int N = y.size();
+    prepareForces(y, t);
+    stats.forceEvaluations += N;
+
+    // Each particle only reads shared state and writes its own derivative
+    workers().parallelFor(N, [&](std::size_t begin, std::size_t end, unsigned) {
+        for (int i = begin; i < static_cast<int>(end); i++) {
+            Vec a = computeForce(y, i) * (1.f / particles.mass[i]);
+            k.x[i] = y.vx[i];
+            k.y[i] = y.vy[i];
+            k.z[i] = y.vz[i];
+            k.vx[i] = a.x;
+            k.vy[i] = a.y;
+            k.vz[i] = a.z;
+        }
+    });
+}
+
+template <typename Real> typename PhysicsEngineT<Real>::Vec PhysicsEngineT<Real>::computeForce(const State& y, int i, ForceMethod method, bool magnetic) {
+    int N = y.size();
+
+    // The tree, mesh and vector kernels work on the float copy of the stage
+    const Vec3f pos(y.position(i));
+    const float kq = ColoumbConstant * static_cast<float>(particles.charge[i]);
+    const float gm = GravitationalConstant * static_cast<float>(particles.mass[i]);
+
+    Vec force = Vec();
+    switch (method)
+    {
+        case ForceMethod::AllPairs:
+            if (kernelPath == PairKernel::Path::Scalar || !floatPairs) {
+                for (int j = 0; j < N; j++) {
+                    if (i == j) continue;
+                    force = force + computeColoumbForce(y, i, j);
+                    force = force + computeGravitationalForce(y, i, j);
+                }
+            } else if (std::is_same<Real, float>::value) {
+                force = Vec(PairKernel::sum(kernelPath, stageX, stageY, stageZ,
+                                            floatCharges(), floatMasses(), 0, N, pos, kq, gm));
+            } else {
+                for (int b = 0; b < N; b += PairBlock)
+                    force = force + Vec(PairKernel::sum(kernelPath, stageX, stageY, stageZ, floatCharges(), floatMasses(),
+                                                        b, std::min<std::size_t>(N, b + PairBlock), pos, kq, gm));
+            }
+            break;
+        case ForceMethod::BarnesHut:
+            force = Vec(tree.computeForce(i, pos, kq, gm, theta));
+            break;
+        case ForceMethod::Tiled:
+            force = Vec(tiledFx[i], tiledFy[i], tiledFz[i]);
+            break;
+        case ForceMethod::ParticleMesh:
+            force = Vec(mesh.computeForce(i, pos, kq, gm));
+            break;
     }
 
     N = fields.size();
     for (int j = 0; j < N; j++) {
-        Field f = fields.at(j);
+        const Field& f = fields[j];
         switch (f.type)
         {
             case Field::Type::Electric:
-                force = force + computeElectricFieldForce(scene[i], f);
+                force = force + computeElectricFieldForce(i, f);
                 break;
             case Field::Type::Magnetic:
-                force = force + computeMagneticFieldForce(scene[i], f);
+                if (magnetic)
+                    force = force + computeMagneticFieldForce(y, i, f);
                 break;
         }
     }
@@ -147,29 +835,243 @@ Vec3f PhysicsEngine::computeForce(const std::vector<PhysicsObject*> scene, const
     return force;
 }
 
-Vec3f PhysicsEngine::computeColoumbForce(const PhysicsObject* target, const PhysicsObject* emitter) {
-    float scale = ColoumbConstant * target->charge * emitter->charge;
-    Vec3f r = target->obj->center - emitter->obj->center;
-    float dist = r.magnitude();
+// Interactions between tile [iBegin, iEnd) and tile [jBegin, jEnd), each pair visited once
+// Equal and opposite forces land in the f arrays; a tile against itself only takes j > i
+// Pairs are computed in Pair and accumulated in Acc, which is wider in mixed precision
+template <typename Pair, typename Acc>
+static void interactTiles(const Pair* x, const Pair* y, const Pair* z, const Pair* q, const Pair* m,
+                          std::size_t iBegin, std::size_t iEnd, std::size_t jBegin, std::size_t jEnd,
+                          Acc* fx, Acc* fy, Acc* fz) {
+    const bool diagonal = (iBegin == jBegin);
+    for (std::size_t i = iBegin; i < iEnd; i++) {
+        const Pair xi = x[i], yi = y[i], zi = z[i];
+        const Pair kq = ColoumbConstantOf<Pair> * q[i];
+        const Pair gm = GravitationalConstantOf<Pair> * m[i];
+        Acc fxi = 0, fyi = 0, fzi = 0;
+
+        for (std::size_t j = diagonal ? i + 1 : jBegin; j < jEnd; j++) {
+            Pair dx = xi - x[j];
+            Pair dy = yi - y[j];
+            Pair dz = zi - z[j];
+            Pair r2 = dx * dx + dy * dy + dz * dz;
+            Pair rinv = (r2 > 0) ? Pair(1) / std::sqrt(r2) : Pair(0);
+            Pair s = (kq * q[j] - gm * m[j]) * rinv * rinv * rinv;
+
+            fxi += dx * s; fyi += dy * s; fzi += dz * s;
+            fx[j] -= dx * s; fy[j] -= dy * s; fz[j] -= dz * s;
+        }
+
+        fx[i] += fxi; fy[i] += fyi; fz[i] += fzi;
+    }
+}
+
+// Float and mixed engines tile the float copy of the stage, double engines the stage itself
+template <typename Real> void PhysicsEngineT<Real>::computeTiledForces(const State& y) {
+    if (floatPairs)
+        computeTiledForcesIn(stageX, stageY, stageZ, floatCharges(), floatMasses(), y.size());
+    else
+        computeTiledForcesIn(y.x.data(), y.y.data(), y.z.data(), particles.charge.data(), particles.mass.data(), y.size());
+}
+
+// Newton's third law all-pairs sum over cache-sized tiles
+// Tile pairs are split across threads in a fixed order, each thread accumulating into its own
+// buffer; buffers are then reduced in thread order so a given thread count is reproducible
+template <typename Real> template <typename Pair>
+void PhysicsEngineT<Real>::computeTiledForcesIn(const Pair* x, const Pair* y, const Pair* z,
+                                                const Pair* q, const Pair* m, std::size_t N) {
+    const std::size_t T = (N + TileSize - 1) / TileSize;
+    const unsigned W = workers().size();
+
+    tiledFx.resize(N); tiledFy.resize(N); tiledFz.resize(N);
+    threadForces.assign(W * 3 * N, Real(0));
+
+    // Upper triangle of tile pairs, row by row so tile I stays resident
+    std::vector<std::pair<std::size_t, std::size_t>> tilePairs;
+    tilePairs.reserve(T * (T + 1) / 2);
+    for (std::size_t I = 0; I < T; I++)
+        for (std::size_t J = I; J < T; J++)
+            tilePairs.push_back({I, J});
+
+    workers().parallelFor(tilePairs.size(), [&](std::size_t begin, std::size_t end, unsigned w) {
+        Real* fx = threadForces.data() + (3 * w + 0) * N;
+        Real* fy = threadForces.data() + (3 * w + 1) * N;
+        Real* fz = threadForces.data() + (3 * w + 2) * N;
+
+        for (std::size_t p = begin; p < end; p++) {
+            std::size_t I = tilePairs[p].first, J = tilePairs[p].second;
+            interactTiles(x, y, z, q, m,
+                          I * TileSize, std::min(N, (I + 1) * TileSize),
+                          J * TileSize, std::min(N, (J + 1) * TileSize),
+                          fx, fy, fz);
+        }
+    });
+
+    workers().parallelFor(N, [&](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t i = begin; i < end; i++) {
+            Real fx = 0, fy = 0, fz = 0;
+            for (unsigned w = 0; w < W; w++) {
+                fx += threadForces[(3 * w + 0) * N + i];
+                fy += threadForces[(3 * w + 1) * N + i];
+                fz += threadForces[(3 * w + 2) * N + i];
+            }
+            tiledFx[i] = fx; tiledFy[i] = fy; tiledFz[i] = fz;
+        }
+    });
+}
+
+template <typename Real> typename PhysicsEngineT<Real>::Vec PhysicsEngineT<Real>::computeColoumbForce(const State& y, int target, int emitter) {
+    Real scale = ColoumbConstantOf<Real> * particles.charge[target] * particles.charge[emitter];
+    Vec r = y.position(target) - y.position(emitter);
+    Real dist = r.magnitude();
+    // Coincident bodies have no direction to push along, as in the vector kernels
+    if (dist == 0) return Vec();
     scale /= dist * dist * dist;
     return r * scale;
 }
 
-Vec3f PhysicsEngine::computeGravitationalForce(const PhysicsObject* target, const PhysicsObject* emitter) {
-    float scale = -GravitationalConstant * target->mass * emitter->mass;
-    Vec3f r = target->obj->center - emitter->obj->center;
-    float dist = r.magnitude();
+template <typename Real> typename PhysicsEngineT<Real>::Vec PhysicsEngineT<Real>::computeGravitationalForce(const State& y, int target, int emitter) {
+    Real scale = -GravitationalConstantOf<Real> * particles.mass[target] * particles.mass[emitter];
+    Vec r = y.position(target) - y.position(emitter);
+    Real dist = r.magnitude();
+    if (dist == 0) return Vec();
     scale /= dist * dist * dist;
     return r * scale;
 }
 
-Vec3f PhysicsEngine::computeElectricFieldForce(const PhysicsObject* target, const Field E) {
-    float mag = E.strength * target->charge;
-    return E.direction * mag;
+template <typename Real> typename PhysicsEngineT<Real>::Vec PhysicsEngineT<Real>::computeElectricFieldForce(int target, const Field& E) {
+    return Vec(E.at(target)) * particles.charge[target];
 }
 
-Vec3f PhysicsEngine::computeMagneticFieldForce(const PhysicsObject* target, const Field B) {
-    Vec3f qv = target->velocity * target->charge;
-    Vec3f Bvect = B.direction * B.strength;
+template <typename Real> typename PhysicsEngineT<Real>::Vec PhysicsEngineT<Real>::computeMagneticFieldForce(const State& y, int target, const Field& B) {
+    Vec qv = y.velocity(target) * particles.charge[target];
+    Vec Bvect = Vec(B.at(target));
     return qv.cross(Bvect);
-}
\ No newline at end of file
+}
+
+/*******************************************************************
+                        FLOAT COPIES
+********************************************************************/
+
+// Point the stage pointers at y, copying it to float first when the engine steps in double
+template <typename Real> void PhysicsEngineT<Real>::floatPositions(const State& y) {
+    if constexpr (std::is_same<Real, float>::value) {
+        stageX = y.x.data(); stageY = y.y.data(); stageZ = y.z.data();
+    } else {
+        const std::size_t N = y.size();
+        shadowX.resize(N); shadowY.resize(N); shadowZ.resize(N);
+        workers().parallelFor(N, [&](std::size_t begin, std::size_t end, unsigned) {
+            for (std::size_t i = begin; i < end; i++) {
+                shadowX[i] = static_cast<float>(y.x[i]);
+                shadowY[i] = static_cast<float>(y.y[i]);
+                shadowZ[i] = static_cast<float>(y.z[i]);
+            }
+        });
+        stageX = shadowX.data(); stageY = shadowY.data(); stageZ = shadowZ.data();
+    }
+}
+
+template <typename Real> const float* PhysicsEngineT<Real>::floatCharges() const {
+    if constexpr (std::is_same<Real, float>::value) return particles.charge.data();
+    else return chargeF.data();
+}
+
+template <typename Real> const float* PhysicsEngineT<Real>::floatMasses() const {
+    if constexpr (std::is_same<Real, float>::value) return particles.mass.data();
+    else return massF.data();
+}
+
+template <typename Real> void PhysicsEngineT<Real>::exportPose(AlignedFloats& x, AlignedFloats& y, AlignedFloats& z,
+                                                               AlignedFloats& qw, AlignedFloats& qx, AlignedFloats& qy, AlignedFloats& qz) const {
+    x.assign(particles.x.begin(), particles.x.end());
+    y.assign(particles.y.begin(), particles.y.end());
+    z.assign(particles.z.begin(), particles.z.end());
+    qw.assign(particles.qw.begin(), particles.qw.end());
+    qx.assign(particles.qx.begin(), particles.qx.end());
+    qy.assign(particles.qy.begin(), particles.qy.end());
+    qz.assign(particles.qz.begin(), particles.qz.end());
+}
+
+// Float charges and masses for double engines, after the particles were loaded
+template <typename Real> void PhysicsEngineT<Real>::refreshFloatCopies() {
+    if (!std::is_same<Real, float>::value) {
+        chargeF.assign(particles.charge.begin(), particles.charge.end());
+        massF.assign(particles.mass.begin(), particles.mass.end());
+    }
+}
+
+/*******************************************************************
+                        CHECKPOINTS
+********************************************************************/
+
+// Real arrays are written in the engine's precision and converted on load if another precision resumes them
+template <typename Real> void PhysicsEngineT<Real>::saveState(Checkpoint::Writer& out) const {
+    out.put<std::uint32_t>(sizeof(Real));
+
+    const AlignedArray<Real>* reals[] = { &particles.x, &particles.y, &particles.z,
+                                          &particles.vx, &particles.vy, &particles.vz,
+                                          &particles.mass, &particles.charge };
+    for (const AlignedArray<Real>* a : reals)
+        out.putArray(*a);
+
+    const AlignedFloats* floats[] = { &particles.radius, &particles.qw, &particles.qx, &particles.qy, &particles.qz,
+                                      &particles.wx, &particles.wy, &particles.wz,
+                                      &particles.alphaX, &particles.alphaY, &particles.alphaZ };
+    for (const AlignedFloats* a : floats)
+        out.putArray(*a);
+
+    // Integrator history, so adaptive and block steps carry on exactly where they stopped
+    out.put<double>(dpStep);
+    out.put<std::uint8_t>(blockPrimed);
+    out.putArray(blockLevel);
+    out.putArray(blockAx);
+    out.putArray(blockAy);
+    out.putArray(blockAz);
+}
+
+template <typename Real> void PhysicsEngineT<Real>::loadState(Checkpoint::Reader& in) {
+    const std::uint32_t stored = in.get<std::uint32_t>();
+    if (stored != sizeof(float) && stored != sizeof(double))
+        in.fail("unknown scalar size " + std::to_string(stored));
+    auto getReals = [&](AlignedArray<Real>& a) {
+        if (stored == sizeof(double))
+            in.getArrayAs<double>(a);
+        else
+            in.getArrayAs<float>(a);
+    };
+
+    AlignedArray<Real>* reals[] = { &particles.x, &particles.y, &particles.z,
+                                    &particles.vx, &particles.vy, &particles.vz,
+                                    &particles.mass, &particles.charge };
+    for (AlignedArray<Real>* a : reals)
+        getReals(*a);
+
+    AlignedFloats* floats[] = { &particles.radius, &particles.qw, &particles.qx, &particles.qy, &particles.qz,
+                                &particles.wx, &particles.wy, &particles.wz,
+                                &particles.alphaX, &particles.alphaY, &particles.alphaZ };
+    for (AlignedFloats* a : floats)
+        in.getArray(*a);
+
+    dpStep = static_cast<Real>(in.get<double>());
+    blockPrimed = in.get<std::uint8_t>() != 0;
+    in.getArray(blockLevel);
+    getReals(blockAx);
+    getReals(blockAy);
+    getReals(blockAz);
+
+    const std::size_t N = particles.size();
+    for (AlignedArray<Real>* a : reals)
+        if (a->size() != N) in.fail("particle arrays differ in length");
+    for (AlignedFloats* a : floats)
+        if (a->size() != N) in.fail("particle arrays differ in length");
+    // Block history is empty until the first block step, then one entry per particle
+    const std::size_t blockN = blockPrimed ? N : blockLevel.size() == 0 ? 0 : N;
+    if (blockLevel.size() != blockN || blockAx.size() != blockN || blockAy.size() != blockN || blockAz.size() != blockN)
+        in.fail("block step arrays do not match the particles");
+    for (int level : blockLevel)
+        if (level < 0 || level > maxLevel) in.fail("block level " + std::to_string(level) + " out of range");
+
+    refreshFloatCopies();
+}
+
+template class PhysicsEngineT<float>;
+template class PhysicsEngineT<double>;
@@ -0,0 +1,234 @@
+#include "Rasterizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+void Rasterizer::resize(int width, int height) {
+    this->width = std::max(width, 0);
+    this->height = std::max(height, 0);
+    tilesX = (this->width + TileSize - 1) / TileSize;
+    tilesY = (this->height + TileSize - 1) / TileSize;
+    color.assign(static_cast<std::size_t>(this->width) * this->height, 0);
+    depth.assign(color.size(), 0.0f);
+    bins.clear();
+}
+
+void Rasterizer::clear(std::uint32_t color) {
+    background = color;
+    triangles.clear();
+    lines.clear();
+    order.clear();
+}
+
+std::uint32_t Rasterizer::pack(float r, float g, float b) {
+    auto channel = [](float c) {
+        return static_cast<std::uint32_t>(std::min(std::max(c, 0.0f), 255.0f));
+    };
+    return 0xFF000000u | (channel(r) << 16) | (channel(g) << 8) | channel(b);
+}
+
+// Pixel centers inside all three edges are covered. A center exactly on an edge belongs to the
+// triangle only if the edge is a top or left one, so triangles sharing an edge never both draw it
+void Rasterizer::fillTriangle(const RasterVertex& a, const RasterVertex& b, const RasterVertex& c) {
+    // Twice the signed area, positive when a, b, c run clockwise on screen
+    float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    if (!(std::fabs(area) > 0) || !std::isfinite(area))
+        return;
+
+    const RasterVertex* v[3] = { &a, &b, &c };
+    if (area < 0) {
+        std::swap(v[1], v[2]);
+        area = -area;
+    }
+
+    TriangleSetup t;
+    float minX = std::min({a.x, b.x, c.x}), maxX = std::max({a.x, b.x, c.x});
+    float minY = std::min({a.y, b.y, c.y}), maxY = std::max({a.y, b.y, c.y});
+    t.x0 = std::max(0, static_cast<int>(std::floor(std::max(minX, -1.0f))));
+    t.x1 = std::min(width - 1, static_cast<int>(std::ceil(std::min(maxX, static_cast<float>(width)))));
+    t.y0 = std::max(0, static_cast<int>(std::floor(std::max(minY, -1.0f))));
+    t.y1 = std::min(height - 1, static_cast<int>(std::ceil(std::min(maxY, static_cast<float>(height)))));
+    if (t.x0 > t.x1 || t.y0 > t.y1)
+        return;
+
+    // Edge k runs from v[k+1] to v[k+2] and is zero there, its value at v[k] is the area
+    for (int k = 0; k < 3; k++) {
+        const RasterVertex& p = *v[(k + 1) % 3];
+        const RasterVertex& q = *v[(k + 2) % 3];
+        t.ex[k] = p.x;
+        t.ey[k] = p.y;
+        t.dx[k] = q.x - p.x;
+        t.dy[k] = q.y - p.y;
+        // Clockwise on a y-down screen, top edges run to the right and left edges run up
+        t.topLeft[k] = (p.y == q.y && q.x > p.x) || q.y < p.y;
+    }
+
+    // Attributes over z interpolate linearly on screen
+    t.invArea = 1.0f / area;
+    for (int k = 0; k < 3; k++) {
+        t.w[k] = 1.0f / v[k]->z;
+        t.r[k] = v[k]->r * t.w[k];
+        t.g[k] = v[k]->g * t.w[k];
+        t.b[k] = v[k]->b * t.w[k];
+    }
+
+    order.push_back(static_cast<std::uint32_t>(triangles.size()));
+    triangles.push_back(t);
+}
+
+// The segment is cut to the screen first (Liang-Barsky) so far away ends cost nothing
+void Rasterizer::drawLine(const RasterVertex& a, const RasterVertex& b) {
+    float t0 = 0, t1 = 1;
+    const float dx = b.x - a.x, dy = b.y - a.y;
+    const float p[4] = { -dx, dx, -dy, dy };
+    const float q[4] = { a.x, width - a.x, a.y, height - a.y };
+    for (int k = 0; k < 4; k++) {
+        if (p[k] == 0) {
+            if (q[k] < 0) return;
+            continue;
+        }
+        float t = q[k] / p[k];
+        if (p[k] < 0) t0 = std::max(t0, t);
+        else t1 = std::min(t1, t);
+    }
+    if (!(t0 <= t1))
+        return;
+
+    LineSetup l;
+    l.xs = a.x + dx * t0;
+    l.ys = a.y + dy * t0;
+    l.dx = dx;
+    l.dy = dy;
+    l.t0 = t0;
+    l.t1 = t1;
+    l.wa = 1.0f / a.z;
+    l.wb = 1.0f / b.z;
+    l.steps = static_cast<int>(std::ceil(std::max(std::fabs(dx), std::fabs(dy)) * (t1 - t0)));
+    l.color = pack(a.r, a.g, a.b);
+
+    float xe = l.xs + dx * (t1 - t0), ye = l.ys + dy * (t1 - t0);
+    l.x0 = std::max(0, static_cast<int>(std::min(l.xs, xe)));
+    l.x1 = std::min(width - 1, static_cast<int>(std::max(l.xs, xe)));
+    l.y0 = std::max(0, static_cast<int>(std::min(l.ys, ye)));
+    l.y1 = std::min(height - 1, static_cast<int>(std::max(l.ys, ye)));
+    if (l.x0 > l.x1 || l.y0 > l.y1)
+        return;
+
+    order.push_back(static_cast<std::uint32_t>(lines.size()) | LineBit);
+    lines.push_back(l);
+}
+
+void Rasterizer::resolve(ThreadPool& pool) {
+    const int tileCount = tilesX * tilesY;
+    if (bins.size() != pool.size())
+        bins.assign(pool.size(), std::vector<std::vector<std::uint32_t>>(tileCount));
+    for (auto& binner : bins)
+        for (auto& bin : binner)
+            bin.clear();
+
+    // Each thread bins a contiguous run of the submissions into its own lists
+    pool.parallelFor(order.size(), [&](std::size_t begin, std::size_t end, unsigned worker) {
+        std::vector<std::vector<std::uint32_t>>& own = bins[worker];
+        for (std::size_t i = begin; i < end; i++) {
+            std::uint32_t id = order[i];
+            int x0, y0, x1, y1;
+            if (id & LineBit) {
+                const LineSetup& l = lines[id & ~LineBit];
+                x0 = l.x0; y0 = l.y0; x1 = l.x1; y1 = l.y1;
+            } else {
+                const TriangleSetup& t = triangles[id];
+                x0 = t.x0; y0 = t.y0; x1 = t.x1; y1 = t.y1;
+            }
+
+            for (int ty = y0 / TileSize; ty <= y1 / TileSize; ty++)
+                for (int tx = x0 / TileSize; tx <= x1 / TileSize; tx++)
+                    own[ty * tilesX + tx].push_back(id);
+        }
+    });
+
+    // Tiles are handed out one at a time so busy middles of the screen do not hold everyone up
+    std::atomic<int> next(0);
+    pool.parallelFor(pool.size(), [&](std::size_t, std::size_t, unsigned) {
+        for (int tile = next++; tile < tileCount; tile = next++)
+            drawTile(tile);
+    });
+}
+
+void Rasterizer::drawTile(int tile) {
+    const int x0 = (tile % tilesX) * TileSize, y0 = (tile / tilesX) * TileSize;
+    const int x1 = std::min(x0 + TileSize, width) - 1, y1 = std::min(y0 + TileSize, height) - 1;
+
+    for (int y = y0; y <= y1; y++) {
+        std::size_t row = static_cast<std::size_t>(y) * width;
+        std::fill(color.begin() + row + x0, color.begin() + row + x1 + 1, background);
+        std::fill(depth.begin() + row + x0, depth.begin() + row + x1 + 1, 0.0f);
+    }
+
+    for (const auto& binner : bins) {
+        for (std::uint32_t id : binner[tile]) {
+            if (id & LineBit)
+                lineInTile(lines[id & ~LineBit], x0, y0, x1, y1);
+            else
+                triangleInTile(triangles[id], x0, y0, x1, y1);
+        }
+    }
+}
+
+void Rasterizer::triangleInTile(const TriangleSetup& t, int x0, int y0, int x1, int y1) {
+    x0 = std::max(x0, t.x0);
+    y0 = std::max(y0, t.y0);
+    x1 = std::min(x1, t.x1);
+    y1 = std::min(y1, t.y1);
+
+    const float px = x0 + 0.5f;
+    for (int y = y0; y <= y1; y++) {
+        const float py = y + 0.5f;
+        float e[3];
+        for (int k = 0; k < 3; k++)
+            e[k] = t.dx[k] * (py - t.ey[k]) - t.dy[k] * (px - t.ex[k]);
+
+        std::uint32_t* colorRow = color.data() + static_cast<std::size_t>(y) * width;
+        float* depthRow = depth.data() + static_cast<std::size_t>(y) * width;
+
+        for (int x = x0; x <= x1; x++) {
+            bool inside = true;
+            for (int k = 0; k < 3; k++)
+                inside &= (e[k] > 0) || (e[k] == 0 && t.topLeft[k]);
+
+            if (inside) {
+                float l0 = e[0] * t.invArea, l1 = e[1] * t.invArea, l2 = e[2] * t.invArea;
+                float wp = l0 * t.w[0] + l1 * t.w[1] + l2 * t.w[2];
+                if (wp > depthRow[x]) {
+                    depthRow[x] = wp;
+                    float z = 1.0f / wp;
+                    colorRow[x] = pack((l0 * t.r[0] + l1 * t.r[1] + l2 * t.r[2]) * z,
+                                       (l0 * t.g[0] + l1 * t.g[1] + l2 * t.g[2]) * z,
+                                       (l0 * t.b[0] + l1 * t.b[1] + l2 * t.b[2]) * z);
+                }
+            }
+
+            for (int k = 0; k < 3; k++)
+                e[k] -= t.dy[k];
+        }
+    }
+}
+
+// Every tile walks the whole line and keeps its own pixels, so each pixel comes out as if drawn alone
+void Rasterizer::lineInTile(const LineSetup& l, int x0, int y0, int x1, int y1) {
+    for (int s = 0; s <= l.steps; s++) {
+        float f = (l.steps > 0) ? static_cast<float>(s) / l.steps : 0.0f;
+        int x = static_cast<int>(l.xs + l.dx * (l.t1 - l.t0) * f);
+        int y = static_cast<int>(l.ys + l.dy * (l.t1 - l.t0) * f);
+        if (x < x0 || x > x1 || y < y0 || y > y1)
+            continue;
+
+        float t = l.t0 + (l.t1 - l.t0) * f;
+        float wp = l.wa + (l.wb - l.wa) * t;
+        std::size_t i = static_cast<std::size_t>(y) * width + x;
+        if (wp > depth[i]) {
+            depth[i] = wp;
+            color[i] = l.color;
+        }
+    }
+}
@@ -1,6 +1,8 @@
 #include "Renderer.h"
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 
 /*******************************************************************
                         CAMERA FUNCTIONS
@@ -67,7 +69,7 @@ void Camera::computeVectors() {
 ********************************************************************/
 
 // Initialize renderer window with dimensions Simulation parameters
-Renderer3D::Renderer3D(Simulation* sim) {
+Renderer3D::Renderer3D(Simulation* sim) : simThread(sim) {
     // Initialize Video
     SDL_Init(SDL_INIT_VIDEO);
 
@@ -102,6 +104,20 @@ Renderer3D::Renderer3D(Simulation* sim) {
         std::exit(EXIT_FAILURE);
     }
 
+    this->software = (sim->renderMode == Simulation::RenderMode::Software);
+    if (software) {
+        raster.resize(width, height);
+        rasterPool.reset(new ThreadPool(static_cast<unsigned>(sim->renderThreads)));
+        frame = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+        if (!frame) {
+            std::cerr << "Frame texture could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+            SDL_DestroyRenderer(renderer);
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
     this->cam = Camera();
     this->lightDir = sim->lightDir.normalize();
     this->ambient = sim->ambient;
@@ -109,6 +125,7 @@ Renderer3D::Renderer3D(Simulation* sim) {
     this->specWeight = sim->specWeight;
     this->shininess = sim->shininess;
     this->gamma = sim->gamma;
+    buildShadingTables();
 
     this->scale = sim->scale;
     this->sim = sim;
@@ -118,6 +135,8 @@ Renderer3D::Renderer3D(Simulation* sim) {
 Renderer3D::~Renderer3D() {
 
     // Destroy SDL Instance
+    if (frame)
+        SDL_DestroyTexture(frame);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -142,13 +161,18 @@ void Renderer3D::run() {
     bool rotating = false;
     bool panning = false;
     int lastX=0, lastY=0;
-    float simTime = 0.0f;
-    float dt = 1 / 60.0f;
 
     SDL_Event e;
 
     // Load initial scene
     loadScene();
+    try {
+        simThread.start();
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return;
+    }
 
     while (!quit) {
         while (SDL_PollEvent(&e)) {
@@ -198,146 +222,111 @@ void Renderer3D::run() {
         // Recompute camera vectors before each frame
         cam.computeVectors();
 
-        phyeng.integrateForward(scene, fields, simTime, dt);
-        phyeng.eulerRotate(scene, dt);
-        simTime += dt;
+        simThread.acquire();
         renderFrame();
         SDL_Delay(16);  // ~60 FPS
     }
+
+    simThread.stop();
 }
 
 // Load objects of the scene into the Renderer
 void Renderer3D::loadScene() {
+    // Particles, fields and physics settings are loaded by the simulation thread, meshes stay here
+    for (int level = 0; level <= MeshLibrary::MaxLevel; level++)
+        sphereLevels[level] = MeshLibrary::get(MeshLibrary::Shape::Sphere, level);
+
     PhysicsObject* hold = nullptr;
-    for (auto objM : sim->objModels) {
-        hold = loadObjectModel(objM);
+    for (std::size_t i = 0; i < sim->objModels.size(); i++) {
+        hold = loadObjectModel(sim->objModels[i], i);
         scene.push_back(hold);
     }
-
-    for (auto fieldM: sim->fieldModels) 
-        fields.push_back(loadFieldModel(fieldM));
-        
 }
 
-PhysicsObject* Renderer3D::loadObjectModel(ObjectModel objM) {
-    Object* obj = nullptr;
-
+PhysicsObject* Renderer3D::loadObjectModel(ObjectModel objM, std::size_t index) {
     SDL_Color color = {objM.color.r, objM.color.g, objM.color.b, objM.color.a};
 
+    MeshLibrary::Shape shape;
     switch (objM.shape)
     {
         case ObjectModel::Shape::SPHERE:
-            obj = new Sphere(objM.center, objM.radius, color, objM.wireframe);
+            shape = MeshLibrary::Shape::Sphere;
             break;
         case ObjectModel::Shape::ICOSAHEDRON:
-            obj = new Icosahedron(objM.center, objM.radius, color, objM.wireframe);
+            shape = MeshLibrary::Shape::Icosahedron;
             break;
         case ObjectModel::Shape::TETRAHEDRON:
-            obj = new Tetrahedron(objM.center, objM.radius, color, objM.wireframe);
+            shape = MeshLibrary::Shape::Tetrahedron;
             break;
         case ObjectModel::Shape::CUBE:
-            obj = new Cube(objM.center, objM.radius, color, objM.wireframe);
+            shape = MeshLibrary::Shape::Cube;
             break;
         default: // default to a sphere
-            obj = new Sphere(objM.center, objM.radius, color, objM.wireframe);
+            shape = MeshLibrary::Shape::Sphere;
     }
 
-    PhysicsObject* hold = new PhysicsObject(obj, objM.mass, objM.charge);
-    hold->velocity = objM.initVelocity;
+    // Every object of a shape shares one unit mesh scaled by its radius
+    Object* obj = new Object(shape, Vec3f(objM.center), objM.radius, color, objM.wireframe);
+
+    PhysicsObject* hold = new PhysicsObject(obj, index);
     hold->acceleration = objM.initAccel;
-    hold->angularVelocity = objM.initAngVelocity;
-    hold->angularAcceleration = objM.initAngAccel;
 
     return hold;
 }
 
-Field Renderer3D::loadFieldModel(FieldModel fieldM) {
-    Field::Type _type;
-    switch (fieldM.type)
-    {
-        case FieldModel::Type::Electric:
-            _type = Field::Type::Electric;
-            break;
-        case FieldModel::Type::Magnetic:
-            _type = Field::Type::Magnetic;
-            break;
-    }
-
-    return Field(_type, fieldM.strength, fieldM.direction);
-}
-
 // RENDER FUNCTIONS
 
 
 // Clears the screen the draws the objects of the scene
 void Renderer3D::renderFrame() {
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);  // Clear to black
-    SDL_RenderClear(renderer);
-    
-    //Sort scene array by depth against camera
-    sortScene(0, static_cast<int>(scene.size() - 1));
+    if (software) {
+        raster.clear(0xFF000000);  // Clear to black
+    } else {
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);  // Clear to black
+        SDL_RenderClear(renderer);
+        batchVerts.clear();
+        batchIndices.clear();
+    }
+    camVerts.clear();
+    screenVerts.clear();
+    renderList.clear();
+    lineList.clear();
+    drawKeys.clear();
+    drawIds.clear();
     
+    // Pull the latest particle poses into the meshes
+    float alpha = sim->runModel.interpolate ? simThread.blend(std::chrono::steady_clock::now()) : 1.0f;
+    for (PhysicsObject* Pobj : scene)
+        syncObject(Pobj, alpha);
+
     for (PhysicsObject* Pobj : scene) {
+        if (!inFrustum(Pobj->obj))
+            continue;
+        chooseDetail(Pobj->obj);
         drawObject(Pobj->obj);
     }
     
     // Draw a point representing the origin
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);  // White points
+    setDrawColor({255, 255, 255, 255});  // White points
     drawCrosshair();
 
-    SDL_RenderPresent(renderer);
-}
-
-// Sorts objects in a scene from furthest to closest (Potentially replace with quick sort in the future)
-void Renderer3D::sortScene(int L, int R) {
-    if (L < R) {
-        int mid = (L + R) / 2;
-        sortScene(L, mid);
-        sortScene(mid + 1, R);
-        sortSceneMerge(L, R, mid);
-    }
-}
+    drawSorted();
 
-// Helper functon for sortScene 
-void Renderer3D::sortSceneMerge(int L, int R, int mid) {
-
-    int sizeLeft = mid - L + 1;
-    int sizeRight = R - mid;
-
-    PhysicsObject** left = (PhysicsObject**) malloc(sizeof(PhysicsObject*) * sizeLeft);
-    PhysicsObject** right = (PhysicsObject**) malloc(sizeof(PhysicsObject*) * sizeRight);
-
-    for (int i = 0; i < sizeLeft; i++)
-        left[i] = scene.at(L + i);
-    
-    for (int i = 0; i < sizeRight; i++)
-        right[i] = scene.at(mid + i + 1);
-
-    int i = 0, j = 0, k = L;
-
-    while (i < sizeLeft && j < sizeRight) {
-        if (isInFront(left[i]->obj, right[j]->obj))
-            scene.at(k++) = right[j++];
-        else
-            scene.at(k++) = left[i++];
+    // The whole frame goes to the GPU as one texture
+    if (software) {
+        raster.resolve(*rasterPool);
+        SDL_UpdateTexture(frame, nullptr, raster.pixels(), raster.pitch());
+        SDL_RenderCopy(renderer, frame, nullptr, nullptr);
+    } else {
+        flushBatch();
     }
 
-    while (i < sizeLeft)
-        scene.at(k++) = left[i++];
-    while (j < sizeRight)
-        scene.at(k++) = right[j++];
-    
-    free(left);
-    free(right);
-
+    SDL_RenderPresent(renderer);
 }
 
-// Returns true if A should be displayed in front of B
-bool Renderer3D::isInFront(const Object* A, const Object* B) {
-    Vec3f Acenter = worldToCam(A->center);
-    Vec3f Bcenter = worldToCam(B->center);
-
-    return (Acenter.z < Bcenter.z) ? true : false;
+// Place an object's mesh at its particle's position and orientation in the latest snapshots
+void Renderer3D::syncObject(PhysicsObject* Pobj, float alpha) {
+    Pobj->obj->place(simThread.position(Pobj->index, alpha), simThread.orientation(Pobj->index, alpha));
 }
 
 // DRAW FUNCTIONS
@@ -358,13 +347,21 @@ void Renderer3D::drawPoint(const Vec3f &point) {
 
 // Draws a line from point1 to point2
 void Renderer3D::drawLine(const Vec3f& point1, const Vec3f& point2){
-
     // Transform relative to the camera
-    Vec3f C1 = worldToCam(point1);
-    Vec3f C2 = worldToCam(point2);
+    drawCamLine(worldToCam(point1), worldToCam(point2));
+}
 
+// Draws a line between two camera space points
+void Renderer3D::drawCamLine(Vec3f C1, Vec3f C2) {
     // If the line is completely behind the camera
     if (!clipLineAgainstCam(C1, C2)) return;
+
+    if (software) {
+        RasterVertex color = { 0, 0, 0, static_cast<float>(lineColor.r),
+                               static_cast<float>(lineColor.g), static_cast<float>(lineColor.b) };
+        raster.drawLine(camToRaster(C1, color), camToRaster(C2, color));
+        return;
+    }
     
     // Transform from camera space to screen coords
     ProjPos p1 = camToScreen(C1);
@@ -376,119 +373,292 @@ void Renderer3D::drawLine(const Vec3f& point1, const Vec3f& point2){
             return;
         }
 
-    SDL_RenderDrawLine(renderer, p1.x, p1.y, p2.x, p2.y);
+    // Sorted in with the triangles by its middle
+    drawKeys.push_back(depthKey((C1.z + C2.z) * 0.5f));
+    drawIds.push_back(static_cast<std::uint32_t>(lineList.size()) | LineBit);
+    lineList.push_back({p1, p2, lineColor});
 
 }
 
+// Pick the sphere level whose triangle edges come out about TargetEdge pixels long
+// A level n icosphere of radius r has edges of about 1.1 r / 2^n
+void Renderer3D::chooseDetail(Object* obj) {
+    if (obj->shape != MeshLibrary::Shape::Sphere)
+        return;
+
+    const float TargetEdge = 8.0f;
+
+    // Bodies reaching past the near plane get full detail
+    float z = worldToCam(obj->center).z;
+    int level = MeshLibrary::MaxLevel;
+    if (z > obj->scale + cam.near) {
+        float radiusPx = cam.focalLength * scale * obj->scale / z;
+        float edges = radiusPx * 1.1f / TargetEdge;
+        level = (edges <= 1) ? 0 : std::min(static_cast<int>(std::ceil(std::log2(edges))), MeshLibrary::MaxLevel);
+    }
+    obj->mesh = sphereLevels[level];
+}
+
 // Draws an object (Wireframe or Filled)
 void Renderer3D::drawObject(const Object* obj) {
     setDrawColor(obj->color);
+    std::size_t base = transformVertices(obj);
 
     if (obj->wireframe) {
-        for (Triangle tri : obj->tris) {
-            drawLine(obj->vertices[tri.a], obj->vertices[tri.b]);
-            drawLine(obj->vertices[tri.b], obj->vertices[tri.c]);
-            drawLine(obj->vertices[tri.c], obj->vertices[tri.a]);
+        for (const Triangle& tri : obj->mesh->tris) {
+            drawCamLine(camVerts[base + tri.a], camVerts[base + tri.b]);
+            drawCamLine(camVerts[base + tri.b], camVerts[base + tri.c]);
+            drawCamLine(camVerts[base + tri.c], camVerts[base + tri.a]);
         }
     } else {
-        geometryObjectFill(obj);
+        geometryObjectFill(obj, base);
     }
 }
 
+// True if the object's bounding sphere reaches into the view frustum
+// The side planes pass through the camera and the screen edges, which lie width / 2 pixels
+// out at focalLength * scale pixels in front of it
+bool Renderer3D::inFrustum(const Object* obj) {
+    Vec3f C = worldToCam(obj->center);
+    float r = obj->scale * obj->mesh->radius;
+
+    if (C.z + r < cam.near)
+        return false;
+
+    float slopeX = width * 0.5f / (cam.focalLength * scale);
+    float slopeY = height * 0.5f / (cam.focalLength * scale);
+    if ((std::fabs(C.x) - slopeX * C.z) > r * std::sqrt(1 + slopeX * slopeX))
+        return false;
+    if ((std::fabs(C.y) - slopeY * C.z) > r * std::sqrt(1 + slopeY * slopeY))
+        return false;
+    return true;
+}
+
 void Renderer3D::drawCrosshair() {
     drawLine(cam.target - Vec3f(0.2f, 0, 0), cam.target + Vec3f(0.2f, 0, 0));
     drawLine(cam.target - Vec3f(0, 0.2f, 0), cam.target + Vec3f(0, 0.2f, 0));
     drawLine(cam.target - Vec3f(0, 0, 0.2f), cam.target + Vec3f(0, 0, 0.2f));
 }
 
-// Fill the triangles defining an object with clipping
-void Renderer3D::geometryObjectFill(const Object* obj) {
-
-    size_t numVerts = obj->vertices.size();
+// VERTEX STAGE
 
-    struct RenderTri { int v[3]; Vec3f Acam; Vec3f Bcam; Vec3f Ccam; float depth; };
-    std::vector<Vec3f> vertexNormals(numVerts, Vec3f());
-    std::vector<int> amm(numVerts, 0);
+// Move every mesh vertex to world and camera space, once per object
+// Camera space vertices are appended after the frame's earlier objects, returns where this one starts
+std::size_t Renderer3D::transformVertices(const Object* obj) {
+    obj->toWorld(worldVerts);
 
-    std::vector<RenderTri> renderList;
-    for (auto &t : obj->tris) {
-        Vec3f A = obj->vertices[t.a];
-        Vec3f B = obj->vertices[t.b];
-        Vec3f C = obj->vertices[t.c];
+    std::size_t base = camVerts.size();
+    camVerts.resize(base + worldVerts.size());
+    for (std::size_t i = 0; i < worldVerts.size(); i++)
+        camVerts[base + i] = worldToCam(worldVerts[i]);
+    return base;
+}
 
-        Vec3f v = C - A;
-        Vec3f Norm = (B - A).cross(v).normalize();
-        for (int idx : {t.a, t.b, t.c}) {
-            vertexNormals[idx] = vertexNormals[idx] + Norm;
-            amm[idx]++;
+// Project the vertices from base on that are in front of the near plane, the others keep only their depth
+void Renderer3D::projectVertices(std::size_t base) {
+    screenVerts.resize(camVerts.size());
+    for (std::size_t i = base; i < camVerts.size(); i++) {
+        const Vec3f& C = camVerts[i];
+        RasterVertex& out = screenVerts[i];
+        if (C.z >= cam.near) {
+            float f = cam.focalLength / C.z * scale;
+            out.x = C.x * f + width * 0.5f;
+            out.y = -C.y * f + height * 0.5f;
         }
+        out.z = C.z;
+    }
+}
 
-        Vec3f Acam = worldToCam(A);
-        Vec3f Bcam = worldToCam(B);
-        Vec3f Ccam = worldToCam(C);
-
-        float z = (Acam.z + Bcam.z + Ccam.z) / 3.0f;
-        renderList.push_back({{t.a, t.b, t.c}, Acam, Bcam, Ccam, z});
+// Light the vertices of the triangles that survived culling
+// Vertices behind the near plane are lit too, clipped triangles borrow their colors
+void Renderer3D::shadeVertices(const Object* obj, std::size_t base) {
+    // Uniform scale leaves directions alone
+    Matrix3 rotMat = obj->orientation.toMatrix();
+    const std::vector<Vec3f>& normals = obj->mesh->normals;
+
+    std::size_t numVerts = worldVerts.size();
+    for (std::size_t i = 0; i < numVerts; i++) {
+        if (!vertexUsed[i])
+            continue;
+
+        Vec3f N = rotMat * normals[i];
+        const Vec3f& P = worldVerts[i];
+
+        float diff = 0.5f * std::max(0.0f, N.dot(lightDir)) + 0.5f;
+        Vec3f V = (cam.camPos - P).normalize();
+        Vec3f H = (lightDir + V).normalize();
+        float spec = lookup(specTable, N.dot(H));
+        float intensity = ambient + diffWeight * diff + specWeight * spec;
+        float shade = lookup(gammaTable, intensity);
+
+        RasterVertex& out = screenVerts[base + i];
+        out.r = std::floor(obj->color.r * shade);
+        out.g = std::floor(obj->color.g * shade);
+        out.b = std::floor(obj->color.b * shade);
     }
+}
 
-    for (size_t i = 0; i < numVerts; i++)
-        vertexNormals[i] = (vertexNormals[i] * (1 / static_cast<float>(amm[i]))).normalize();
+// Linear interpolation in a table sampling [0, 1], x is clamped to that range
+float Renderer3D::lookup(const std::vector<float>& table, float x) const {
+    x = std::min(std::max(x, 0.0f), 1.0f) * (ShadeSteps - 1);
+    int i = std::min(static_cast<int>(x), ShadeSteps - 2);
+    float t = x - i;
+    return table[i] + (table[i + 1] - table[i]) * t;
+}
 
-    std::sort(renderList.begin(), renderList.end(),
-        [](auto &L, auto &R){ return L.depth  > R.depth; });
+// Sample pow(x, shininess) and pow(x, 1/gamma) so no vertex calls pow
+void Renderer3D::buildShadingTables() {
+    specTable.resize(ShadeSteps);
+    gammaTable.resize(ShadeSteps);
+    for (int i = 0; i < ShadeSteps; i++) {
+        float x = i / static_cast<float>(ShadeSteps - 1);
+        specTable[i] = std::pow(x, shininess);
+        gammaTable[i] = std::pow(x, 1.0f / gamma);
+    }
+}
 
-    Vec3f lightDir_cam = worldToCam(lightDir).normalize();
+// TRIANGLE STAGE
+
+// Cull and assemble the triangles of an object whose vertices transformVertices moved
+// Only vertices of triangles that survive culling are lit, the triangles wait in renderList for drawSorted
+void Renderer3D::geometryObjectFill(const Object* obj, std::size_t base) {
+    projectVertices(base);
+    vertexUsed.assign(camVerts.size() - base, 0);
+
+    for (const Triangle& t : obj->mesh->tris) {
+        int a = static_cast<int>(base) + t.a, b = static_cast<int>(base) + t.b, c = static_cast<int>(base) + t.c;
+        Vec3f A = camVerts[a];
+        Vec3f B = camVerts[b];
+        Vec3f C = camVerts[c];
+
+        // Meshes wind counterclockwise seen from outside, camera space is left handed,
+        // so a front face has its edge cross product pointing away from the camera
+        Vec3f AB = B - A, AC = C - A;
+        if (AB.cross(AC).dot(A) <= 0)
+            continue;
+
+        if (A.z >= cam.near && B.z >= cam.near && C.z >= cam.near) {
+            RasterVertex corners[3] = { screenVerts[a], screenVerts[b], screenVerts[c] };
+            if (allVertsOutside(corners))
+                continue;
+        } else if (A.z < cam.near && B.z < cam.near && C.z < cam.near) {
+            continue;
+        }
 
-    SDL_Vertex verts[3];
-    for (RenderTri tri : renderList) {
-        auto tris = clipAgainstNearPlane(tri.Acam, tri.Bcam, tri.Ccam);
-        for (auto &t : tris) {
-            std::array<ProjPos, 3> ndc;
-            for (int i = 0; i < 3; i++)
-                ndc[i] = camToScreen(t[i]);
+        vertexUsed[t.a] = vertexUsed[t.b] = vertexUsed[t.c] = 1;
+        // The depth buffer makes order irrelevant
+        if (!software) {
+            drawKeys.push_back(depthKey((A.z + B.z + C.z) / 3.0f));
+            drawIds.push_back(static_cast<std::uint32_t>(renderList.size()));
+        }
+        renderList.push_back({{a, b, c}});
+    }
 
-            if (allVertsOutside(ndc)) continue;
+    shadeVertices(obj, base);
+}
 
-            for (int i = 0; i < 3; i++) {
+// Draw every triangle and line of the frame, the geometry backend far to near across all objects
+void Renderer3D::drawSorted() {
+    if (software) {
+        for (const RenderTri& tri : renderList)
+            clipAndFill(tri);
+        return;
+    }
 
-                int vi = tri.v[i];
+    sortDrawList();
+    for (std::uint32_t id : drawIds) {
+        if (id & LineBit) {
+            const RenderLine& line = lineList[id & ~LineBit];
+            batchLine(line.p1, line.p2, line.color);
+        } else {
+            clipAndFill(renderList[id]);
+        }
+    }
+}
 
-                Vec3f N = vertexNormals[vi];
-                Vec3f P = obj->vertices[vi];
+// Order preserving map of a depth to an unsigned key, inverted so the farthest sorts first
+std::uint32_t Renderer3D::depthKey(float z) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &z, sizeof(bits));
+    bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+    return ~bits;
+}
 
-                float diff = 0.5f * std::max(0.0f, N.dot(lightDir)) + 0.5f;
-                Vec3f V = (cam.position() - P).normalize();
-                Vec3f H = (lightDir + V).normalize();
-                float spec = std::pow(std::max(0.0f, N.dot(H)), shininess);
-                float intensity = ambient + diffWeight * diff + specWeight * spec;
-                intensity = (intensity < 0) ? 0 : intensity;
-                intensity = (intensity > 1) ? 1 : intensity;
+// Stable LSD radix sort of drawIds by drawKeys, a counting pass per byte
+// Equal depths keep their submission order
+void Renderer3D::sortDrawList() {
+    const std::size_t n = drawKeys.size();
+    if (n < 2)
+        return;
+    sortKeys.resize(n);
+    sortIds.resize(n);
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        std::size_t count[257] = {};
+        for (std::uint32_t key : drawKeys)
+            count[((key >> shift) & 0xFF) + 1]++;
+
+        // A byte every key shares leaves the order as it is
+        if (count[((drawKeys[0] >> shift) & 0xFF) + 1] == n)
+            continue;
+
+        for (int b = 0; b < 256; b++)
+            count[b + 1] += count[b];
+        for (std::size_t i = 0; i < n; i++) {
+            std::size_t at = count[(drawKeys[i] >> shift) & 0xFF]++;
+            sortKeys[at] = drawKeys[i];
+            sortIds[at] = drawIds[i];
+        }
+        drawKeys.swap(sortKeys);
+        drawIds.swap(sortIds);
+    }
+}
 
-                SDL_Color color = {
-                    static_cast<Uint8>(obj->color.r * std::pow(intensity, 1.0f/gamma)),
-                    static_cast<Uint8>(obj->color.g * std::pow(intensity, 1.0f/gamma)),
-                    static_cast<Uint8>(obj->color.b * std::pow(intensity, 1.0f/gamma)),
-                    255
-                };
+// Clip a triangle against the near plane and fill what is left
+void Renderer3D::clipAndFill(const RenderTri& tri) {
+    RasterVertex corners[3];
+    const Vec3f& A = camVerts[tri.v[0]];
+    const Vec3f& B = camVerts[tri.v[1]];
+    const Vec3f& C = camVerts[tri.v[2]];
+
+    // Most triangles are entirely in front and reuse the projected vertices
+    if (A.z >= cam.near && B.z >= cam.near && C.z >= cam.near) {
+        for (int i = 0; i < 3; i++)
+            corners[i] = screenVerts[tri.v[i]];
+        fillCorners(corners);
+        return;
+    }
 
-                verts[i].position = { float(ndc[i].x), float(ndc[i].y) };
-                verts[i].color = color;
-                verts[i].tex_coord = {0, 0};
-            }
-    
-            SDL_RenderGeometry(renderer, nullptr, verts, 3, nullptr, 0);
+    std::array<std::array<Vec3f, 3>, 2> clipped;
+    int count = clipAgainstNearPlane(A, B, C, clipped);
+    for (int k = 0; k < count; k++) {
+        for (int i = 0; i < 3; i++) {
+            const RasterVertex& shaded = screenVerts[tri.v[i]];
+            corners[i] = camToRaster(clipped[k][i], shaded);
         }
-
+        fillCorners(corners);
     }
 }
 
+// Hand a projected triangle to the active backend unless it is off screen
+void Renderer3D::fillCorners(const RasterVertex corners[3]) {
+    if (allVertsOutside(corners))
+        return;
+
+    if (software)
+        raster.fillTriangle(corners[0], corners[1], corners[2]);
+    else
+        batchTriangle(corners);
+}
+
 // Fill helper functions
 
 // Helper function to validate triangle fill visibility
-bool Renderer3D::allVertsOutside(std::array<ProjPos, 3> ndc) {
+bool Renderer3D::allVertsOutside(const RasterVertex corners[3]) {
     bool allLeft = true, allRight = true, allBottom = true, allTop = true;
 
-    for (auto &p : ndc) {
+    for (int i = 0; i < 3; i++) {
+        const RasterVertex& p = corners[i];
         allLeft &= (p.x < 0);
         allRight &= (p.x > width);
         allBottom &= (p.y < 0);
@@ -507,65 +677,94 @@ static Vec3f intersectPlane(const Vec3f& P, const Vec3f&Q, float nearPlane) {
 }
 
 // Clip the triangle ABC against the nearPlane defined by the camera
-// Can return 0, 1, or 2 triangles
-std::vector<std::array<Vec3f, 3>> Renderer3D::clipAgainstNearPlane(const Vec3f& A, const Vec3f& B, const Vec3f& C) {
-    struct Vtx { Vec3f p; bool inside; };
-    std::array<Vtx, 3> v = {{
-        {A, A.z >= cam.near},
-        {B, B.z >= cam.near},
-        {C, C.z >= cam.near}
-    }};
-
-    int insideCount = (int) v[0].inside + (int) v[1].inside + (int) v[2].inside;
-    std::vector<std::array<Vec3f, 3>> output;
-
-    // If the entire triangle is clipped
-    if (insideCount == 0)
-        return output;
-    else if (insideCount == 3) {
-        // No clipping has occurred
-        output.push_back({A, B, C});
-        return output;
-    }
-
-    // Helper function adding a clipped vertex between vi and vj
-    auto addIntersection = [&](int i, int j, std::vector<Vec3f>& verts) {
-        verts.push_back(intersectPlane(v[i].p, v[j].p, cam.near));
-    };
-
-    // Build list of points for the clipped polygon
-    std::vector<Vec3f> clippedVerts;
+// Writes 0, 1, or 2 triangles to out and returns how many
+int Renderer3D::clipAgainstNearPlane(const Vec3f& A, const Vec3f& B, const Vec3f& C,
+                                     std::array<std::array<Vec3f, 3>, 2>& out) {
+    const Vec3f* v[3] = { &A, &B, &C };
+    bool inside[3] = { A.z >= cam.near, B.z >= cam.near, C.z >= cam.near };
+
+    // Build list of points for the clipped polygon, at most a quad
+    Vec3f clippedVerts[4];
+    int n = 0;
     for (int i = 0; i < 3; i++) {
         // ni means next i
         int ni = (i + 1) % 3;
-        if (v[i].inside)
-            clippedVerts.push_back(v[i].p);
+        if (inside[i])
+            clippedVerts[n++] = *v[i];
         // If edge corsses the plane, add intersection
-        if (v[i].inside != v[ni].inside)
-            addIntersection(i, ni, clippedVerts);
+        if (inside[i] != inside[ni])
+            clippedVerts[n++] = intersectPlane(*v[i], *v[ni], cam.near);
     }
 
-    // One Trangle
-    if (clippedVerts.size() == 3)
-        output.push_back({ clippedVerts[0], clippedVerts[1], clippedVerts[2] });
-    else if (clippedVerts.size() == 4) {
-        // Two Triangles
-        // quad: verts 0-1-2-3
-        // make two triangles: (0,1,2) and (0,2,3)
-        output.push_back({ clippedVerts[0], clippedVerts[1], clippedVerts[2] });
-        output.push_back({ clippedVerts[0], clippedVerts[2], clippedVerts[3] });
-    }
+    if (n < 3)
+        return 0;
 
-    return output;
-    
+    // One Trangle
+    out[0] = { clippedVerts[0], clippedVerts[1], clippedVerts[2] };
+    if (n == 3)
+        return 1;
+
+    // Two Triangles
+    // quad: verts 0-1-2-3
+    // make two triangles: (0,1,2) and (0,2,3)
+    out[1] = { clippedVerts[0], clippedVerts[2], clippedVerts[3] };
+    return 2;
 }
 
 // Helper function to set Draw Color directly
 void Renderer3D::setDrawColor(SDL_Color color) {
+    lineColor = color;
     SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
 }
 
 
+// BATCH FUNCTIONS
+
+
+// Append a triangle after everything batched so far, SDL draws it over those
+void Renderer3D::batchTriangle(const RasterVertex corners[3]) {
+    int base = static_cast<int>(batchVerts.size());
+    for (int i = 0; i < 3; i++) {
+        const RasterVertex& c = corners[i];
+        SDL_Color color = { static_cast<Uint8>(c.r), static_cast<Uint8>(c.g), static_cast<Uint8>(c.b), 255 };
+        batchVerts.push_back({ {c.x, c.y}, color, {0, 0} });
+        batchIndices.push_back(base + i);
+    }
+}
+
+// The quad covers the pixels from p1 to p2 inclusive, half a pixel either side of their centers
+void Renderer3D::batchLine(ProjPos p1, ProjPos p2, SDL_Color color) {
+    float x1 = p1.x + 0.5f, y1 = p1.y + 0.5f;
+    float x2 = p2.x + 0.5f, y2 = p2.y + 0.5f;
+    float dx = x2 - x1, dy = y2 - y1;
+    float len = std::sqrt(dx * dx + dy * dy);
+    if (len > 0) {
+        dx *= 0.5f / len;
+        dy *= 0.5f / len;
+    } else {
+        // A single pixel
+        dx = 0.5f;
+        dy = 0;
+    }
+
+    int base = static_cast<int>(batchVerts.size());
+    batchVerts.push_back({ {x1 - dx - dy, y1 - dy + dx}, color, {0, 0} });
+    batchVerts.push_back({ {x1 - dx + dy, y1 - dy - dx}, color, {0, 0} });
+    batchVerts.push_back({ {x2 + dx + dy, y2 + dy - dx}, color, {0, 0} });
+    batchVerts.push_back({ {x2 + dx - dy, y2 + dy + dx}, color, {0, 0} });
+    for (int i : {0, 1, 2, 0, 2, 3})
+        batchIndices.push_back(base + i);
+}
+
+// Draw the whole batch in one call
+void Renderer3D::flushBatch() {
+    if (batchIndices.empty())
+        return;
+    SDL_RenderGeometry(renderer, nullptr, batchVerts.data(), static_cast<int>(batchVerts.size()),
+                       batchIndices.data(), static_cast<int>(batchIndices.size()));
+}
+
+
 // PROJECTION FUNCTIONS
 
 
@@ -588,6 +787,12 @@ ProjPos Renderer3D::camToScreen(const Vec3f& C) {
     return ProjPos(x, y);
 }
 
+// Same projection as camToScreen without rounding to whole pixels, colored like shaded
+RasterVertex Renderer3D::camToRaster(const Vec3f& C, const RasterVertex& shaded) {
+    float f = cam.focalLength / C.z * scale;
+    return { C.x * f + width * 0.5f, -C.y * f + height * 0.5f, C.z, shaded.r, shaded.g, shaded.b };
+}
+
 // Clip a line from point A to point B if necessary
 bool Renderer3D::clipLineAgainstCam(Vec3f& A, Vec3f& B) {
     // If the line is completely behind the camera
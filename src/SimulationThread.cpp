@@ -0,0 +1,142 @@
+#include "SimulationThread.h"
+#include "Checkpoint.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+// Wall time the stepper will try to catch up on at once, anything beyond is dropped
+// so a scene too heavy for real time slows down instead of spiralling
+static const double MaxBacklog = 0.25;
+
+SimulationThread::SimulationThread(Simulation* sim) : quit(false), back(1), front(0), ready(2) {
+    this->sim = sim;
+    this->dt = sim->runModel.dt > 0 ? sim->runModel.dt : 1 / 60.0f;
+}
+
+SimulationThread::~SimulationThread() {
+    stop();
+}
+
+void SimulationThread::start() {
+    if (worker.joinable())
+        return;
+
+    engine = PhysicsEngine::create(sim->physicsModel);
+    engine->loadSimulation(sim);
+    if (sim->restart) {
+        sim->restart->restore(*engine);
+        simTime = sim->restart->time;
+        step = sim->restart->step;
+        sim->restart.reset();
+    }
+    publish(simTime, step);
+
+    quit.store(false);
+    worker = std::thread(&SimulationThread::loop, this);
+}
+
+void SimulationThread::stop() {
+    quit.store(true);
+    if (!worker.joinable())
+        return;
+
+    worker.join();
+    if (!sim->runModel.checkpoint.empty())
+        saveCheckpoint();
+}
+
+// Errors are reported and stepping goes on, the previous checkpoint is still in place
+void SimulationThread::saveCheckpoint() {
+    try {
+        Checkpoint::write(sim->runModel.checkpoint, *sim, *engine, simTime, step);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+    }
+}
+
+void SimulationThread::loop() {
+    using clock = std::chrono::steady_clock;
+
+    const int every = sim->runModel.checkpoint.empty() ? 0 : sim->runModel.checkpointEvery;
+    double accumulator = 0.0;
+    clock::time_point last = clock::now();
+
+    while (!quit.load(std::memory_order_relaxed)) {
+        clock::time_point now = clock::now();
+        accumulator += std::min(std::chrono::duration<double>(now - last).count(), MaxBacklog);
+        last = now;
+
+        // Fixed steps only, the remainder carries over to the next pass
+        bool stepped = false;
+        while (accumulator >= dt && !quit.load(std::memory_order_relaxed)) {
+            engine->integrateForward(simTime, dt);
+            simTime += dt;
+            accumulator -= dt;
+            step++;
+            stepped = true;
+
+            if (every > 0 && step % every == 0)
+                saveCheckpoint();
+        }
+
+        if (stepped)
+            publish(simTime, step);
+        else
+            std::this_thread::sleep_for(std::chrono::duration<double>(dt - accumulator));
+    }
+}
+
+// Fill the back slot and swap it with the parked one
+void SimulationThread::publish(double simTime, long step) {
+    Snapshot& snap = slots[back];
+
+    snap.time = simTime;
+    snap.step = step;
+    engine->exportPose(snap.x, snap.y, snap.z, snap.qw, snap.qx, snap.qy, snap.qz);
+    snap.published = std::chrono::steady_clock::now();
+
+    back = ready.exchange(back | FreshBit, std::memory_order_acq_rel) & ~FreshBit;
+}
+
+bool SimulationThread::acquire() {
+    if ((ready.load(std::memory_order_acquire) & FreshBit) == 0)
+        return false;
+
+    // The old front becomes prev and prev's buffers go back to the writer to be overwritten
+    std::swap(prev, slots[front]);
+    front = ready.exchange(front, std::memory_order_acq_rel) & ~FreshBit;
+    return true;
+}
+
+float SimulationThread::blend(std::chrono::steady_clock::time_point now) const {
+    const Snapshot& cur = slots[front];
+    if (prev.step < 0 || cur.published <= prev.published)
+        return 1.0f;
+
+    // Rendering trails the stepper by one publish interval so there is always a pair to blend
+    double span = std::chrono::duration<double>(cur.published - prev.published).count();
+    double into = std::chrono::duration<double>(now - cur.published).count();
+    return static_cast<float>(std::clamp(into / span, 0.0, 1.0));
+}
+
+Vec3f SimulationThread::position(std::size_t i, float alpha) const {
+    const Snapshot& cur = slots[front];
+    Vec3f now(cur.x[i], cur.y[i], cur.z[i]);
+    if (alpha >= 1.0f || i >= prev.x.size())
+        return now;
+
+    Vec3f before(prev.x[i], prev.y[i], prev.z[i]);
+    return before + (now - before) * alpha;
+}
+
+Quaternion SimulationThread::orientation(std::size_t i, float alpha) const {
+    const Snapshot& cur = slots[front];
+    Quaternion now(cur.qw[i], cur.qx[i], cur.qy[i], cur.qz[i]);
+    if (alpha >= 1.0f || i >= prev.qw.size())
+        return now;
+
+    Quaternion before(prev.qw[i], prev.qx[i], prev.qy[i], prev.qz[i]);
+    return Quaternion::nlerp(before, now, alpha);
+}
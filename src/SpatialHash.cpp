@@ -0,0 +1,113 @@
+#include "SpatialHash.h"
+
+#include <algorithm>
+#include <cmath>
+
+void SpatialHash::build(const float* x, const float* y, const float* z, const float* radius, int n, ThreadPool& pool) {
+    this->x = x;
+    this->y = y;
+    this->z = z;
+    this->radius = radius;
+    count = n;
+
+    float maxRadius = 0;
+    for (int i = 0; i < n; i++)
+        maxRadius = std::max(maxRadius, radius[i]);
+    invCell = (maxRadius > 0) ? 1.0f / (2 * maxRadius) : 0.0f;
+
+    // About two buckets per sphere keeps unrelated cells from sharing a bucket
+    std::uint32_t tableSize = 1;
+    while (tableSize < 2u * static_cast<std::uint32_t>(std::max(n, 1)))
+        tableSize <<= 1;
+    mask = tableSize - 1;
+
+    const std::uint32_t outside = mask + 1;
+    bucket.resize(n);
+    pool.parallelFor(n, [&](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t i = begin; i < end; i++) {
+            if (!(std::isfinite(x[i]) && std::isfinite(y[i]) && std::isfinite(z[i]))) {
+                bucket[i] = outside;
+                continue;
+            }
+            bucket[i] = hash(cellOf(x[i]), cellOf(y[i]), cellOf(z[i]));
+        }
+    });
+
+    // Counting sort by bucket, stable so each bucket lists its spheres in index order
+    bucketStart.assign(tableSize + 2, 0);
+    for (int i = 0; i < n; i++)
+        bucketStart[bucket[i] + 1]++;
+    for (std::uint32_t b = 0; b <= tableSize; b++)
+        bucketStart[b + 1] += bucketStart[b];
+
+    sorted.resize(n);
+    std::vector<int> fill(bucketStart.begin(), bucketStart.end() - 1);
+    for (int i = 0; i < n; i++)
+        sorted[fill[bucket[i]]++] = i;
+}
+
+const std::vector<SpatialHash::Contact>& SpatialHash::findContacts(ThreadPool& pool) {
+    contacts.clear();
+    if (invCell == 0 || count < 2)
+        return contacts;
+
+    threadContacts.resize(pool.size());
+    pool.parallelFor(bucketStart[mask + 1], [&](std::size_t begin, std::size_t end, unsigned worker) {
+        std::vector<Contact>& found = threadContacts[worker];
+        found.clear();
+
+        // Walking the spheres in bucket order keeps neighbouring queries on nearby table entries,
+        // and leaves out the non-finite ones sorted past the last bucket
+        for (std::size_t s = begin; s < end; s++) {
+            const int i = sorted[s];
+
+            std::int64_t cx = cellOf(x[i]), cy = cellOf(y[i]), cz = cellOf(z[i]);
+
+            // The hash is linear in x, so each row of three cells is three consecutive buckets
+            for (int dz = -1; dz <= 1; dz++)
+            for (int dy = -1; dy <= 1; dy++) {
+                std::uint32_t row = hash(cx - 1, cy + dy, cz + dz);
+                for (std::uint32_t dx = 0; dx < 3; dx++) {
+                    std::uint32_t b = (row + dx) & mask;
+                    for (int k = bucketStart[b]; k < bucketStart[b + 1]; k++) {
+                        int j = sorted[k];
+                        if (j <= i) continue;
+
+                        float ddx = x[j] - x[i], ddy = y[j] - y[i], ddz = z[j] - z[i];
+                        float reach = radius[i] + radius[j];
+                        if (ddx * ddx + ddy * ddy + ddz * ddz < reach * reach)
+                            found.push_back({i, j});
+                    }
+                }
+            }
+        }
+    });
+
+    for (const std::vector<Contact>& found : threadContacts)
+        contacts.insert(contacts.end(), found.begin(), found.end());
+
+    // Index order makes the response independent of the thread count. Two rows that hash onto the
+    // same buckets report their pairs twice, which is rare enough to drop here instead of tracking
+    std::sort(contacts.begin(), contacts.end(), [](const Contact& a, const Contact& b) {
+        return a.i != b.i ? a.i < b.i : a.j < b.j;
+    });
+    contacts.erase(std::unique(contacts.begin(), contacts.end(), [](const Contact& a, const Contact& b) {
+        return a.i == b.i && a.j == b.j;
+    }), contacts.end());
+    return contacts;
+}
+
+// Clamped so far away spheres still give a valid cell
+std::int64_t SpatialHash::cellOf(float p) const {
+    const double limit = 1e15;
+    double c = std::floor(static_cast<double>(p) * invCell);
+    return static_cast<std::int64_t>(std::min(std::max(c, -limit), limit));
+}
+
+// Linear in cx so x neighbours are neighbouring buckets, y and z rows scattered by large odd factors
+std::uint32_t SpatialHash::hash(std::int64_t cx, std::int64_t cy, std::int64_t cz) const {
+    std::uint64_t h = static_cast<std::uint64_t>(cx) +
+                      static_cast<std::uint64_t>(cy) * 73856093u +
+                      static_cast<std::uint64_t>(cz) * 19349663u;
+    return static_cast<std::uint32_t>(h) & mask;
+}
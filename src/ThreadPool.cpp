@@ -0,0 +1,78 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    threadCount = (threads == 0) ? 1 : threads;
+
+    // The calling thread works as worker 0
+    for (unsigned w = 1; w < threadCount; w++)
+        workers.emplace_back(&ThreadPool::workerLoop, this, w);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : workers)
+        t.join();
+}
+
+void ThreadPool::parallelFor(std::size_t n, const RangeFn& fn) {
+    if (n == 0) return;
+
+    // Not worth waking anyone up
+    if (threadCount == 1 || n < threadCount) {
+        fn(0, n, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        job = &fn;
+        jobSize = n;
+        pending = threadCount - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    runChunk(fn, n, 0);
+
+    std::unique_lock<std::mutex> lock(mtx);
+    done.wait(lock, [this] { return pending == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::workerLoop(unsigned worker) {
+    unsigned seen = 0;
+    while (true) {
+        const RangeFn* fn;
+        std::size_t n;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            fn = job;
+            n = jobSize;
+        }
+
+        runChunk(*fn, n, worker);
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            pending--;
+        }
+        done.notify_one();
+    }
+}
+
+// Worker w always owns the same slice of [0, n)
+void ThreadPool::runChunk(const RangeFn& fn, std::size_t n, unsigned worker) {
+    std::size_t begin = n * worker / threadCount;
+    std::size_t end = n * (worker + 1) / threadCount;
+    if (begin < end)
+        fn(begin, end, worker);
+}
@@ -1,26 +1,48 @@
 #include <iostream>
-#include <SDL.h>
+#include <string>
+#include <cstring>
 
+#include "JSONReader.h"
+#include "Checkpoint.h"
+#include "HeadlessRunner.h"
+#ifdef EMSIM_WITH_SDL
+#include <SDL.h>
 #include "Renderer.h"
+#endif
+
+static void printUsage() {
+    std::cerr << "Usage ./progname (scene.json | --restart CHECKPOINT) [--headless] [--steps N] [--time T] [--dt DT] [--out FILE]"
+              << " [--precision float|double|mixed] [--checkpoint FILE] [--checkpoint-every N]" << std::endl;
+}
 
 int main(int argc, char* argv[]) {
-    
+
     // Validate Correct Arguments
-    if (argc != 2) {
-        std::cerr << "Usage ./progname scene.json" << std::endl;
+    if (argc < 2) {
+        printUsage();
         return 1;
     }
 
-    // Read JSON file and validate a successful read and load
+    // Read JSON file (or the scene saved in a checkpoint) and validate a successful read and load
     Simulation* sim = nullptr;
+    const bool restart = std::strcmp(argv[1], "--restart") == 0;
+    if (restart && argc < 3) {
+        printUsage();
+        return 1;
+    }
     try {
-        sim = new Simulation(argv[1]);
-    } 
+        if (restart) {
+            sim = new Simulation();
+            sim->restart = Checkpoint::open(argv[2], *sim);
+        } else {
+            sim = new Simulation(argv[1]);
+        }
+    }
     catch (const std::exception& e) {
         std::cerr << "Exception: " << e.what() << std::endl;
         delete sim;
         return 1;
-    } 
+    }
     catch (...) {
         std::cerr << "An unknown error occurred while loading scene file..." << std::endl;
         delete sim;
@@ -33,8 +55,63 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    Renderer3D renderer(sim);
-    renderer.run();
+    // Command line options override the scene's run block
+    try {
+        for (int a = restart ? 3 : 2; a < argc; a++) {
+            bool hasValue = a + 1 < argc;
+            if (std::strcmp(argv[a], "--headless") == 0)
+                sim->runModel.headless = true;
+            else if (std::strcmp(argv[a], "--steps") == 0 && hasValue)
+                sim->runModel.steps = std::stoi(argv[++a]);
+            else if (std::strcmp(argv[a], "--time") == 0 && hasValue)
+                sim->runModel.endTime = std::stof(argv[++a]);
+            else if (std::strcmp(argv[a], "--dt") == 0 && hasValue)
+                sim->runModel.dt = std::stof(argv[++a]);
+            else if (std::strcmp(argv[a], "--out") == 0 && hasValue)
+                sim->runModel.output.assign(argv[++a]);
+            else if (std::strcmp(argv[a], "--precision") == 0 && hasValue) {
+                std::string precision(argv[++a]);
+                if (precision == "float")
+                    sim->physicsModel.precision = PhysicsModel::Precision::Float;
+                else if (precision == "double")
+                    sim->physicsModel.precision = PhysicsModel::Precision::Double;
+                else if (precision == "mixed")
+                    sim->physicsModel.precision = PhysicsModel::Precision::Mixed;
+                else
+                    throw std::invalid_argument(precision);
+            }
+            else if (std::strcmp(argv[a], "--checkpoint") == 0 && hasValue)
+                sim->runModel.checkpoint.assign(argv[++a]);
+            else if (std::strcmp(argv[a], "--checkpoint-every") == 0 && hasValue)
+                sim->runModel.checkpointEvery = std::stoi(argv[++a]);
+            else
+                throw std::invalid_argument(argv[a]);
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Invalid argument: " << e.what() << std::endl;
+        printUsage();
+        delete sim;
+        return 1;
+    }
+
+#ifndef EMSIM_WITH_SDL
+    // Built without a window, batch mode is all there is
+    sim->runModel.headless = true;
+#endif
+
+    int status = 0;
+    if (sim->runModel.headless) {
+        HeadlessRunner runner(sim);
+        status = runner.run();
+    }
+#ifdef EMSIM_WITH_SDL
+    else {
+        Renderer3D renderer(sim);
+        renderer.run();
+    }
+#endif
+
     delete sim;
-    return 0;
+    return status;
 }